@@ -0,0 +1,41 @@
+#!/usr/bin/env bash
+# Times wc -j0 on FILE, in the page cache, with WC and with WC_WITHOUT_NUMA,
+# built with -DWITHOUT_NUMA, and prints the best of 5 runs of each:
+#
+#     bench-numa.sh WC WC_WITHOUT_NUMA [FILE]
+#
+# Without FILE, 2 GiB of text are written to a temporary file. On a machine
+# with one NUMA node, both take the same time.
+
+set -eu
+
+if (($# < 2)); then
+    echo "usage: $0 WC WC_WITHOUT_NUMA [FILE]" >&2
+    exit 2
+fi
+
+runs=5
+file=${3:-}
+
+if [[ -z $file ]]; then
+    file=$(mktemp)
+    trap 'rm -f "$file"' EXIT
+    yes 'the quick brown fox jumps over the lazy dog' | head -c 2G >"$file"
+fi
+
+nodes=$(find /sys/devices/system/node -maxdepth 1 -name 'node[0-9]*' | grep -c .)
+echo "$nodes NUMA node(s), $(nproc) CPU(s), $(stat -c %s "$file") bytes"
+
+cat "$file" >/dev/null
+TIMEFORMAT=%R
+
+for wc in "$1" "$2"; do
+    times=()
+
+    for ((i = 0; i < runs; ++i)); do
+        times+=("$({ time "$wc" -j0 "$file" >/dev/null; } 2>&1)")
+    done
+
+    best=$(printf '%s\n' "${times[@]}" | sort -n | head -n 1)
+    echo "$wc: ${best}s"
+done
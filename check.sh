@@ -0,0 +1,214 @@
+#!/usr/bin/env bash
+# Checks that WC counts files large enough to be split into chunks the same
+# with one job as with several, and that it fails cleanly, without crashing or
+# a sanitizer report, on truncated and corrupt archives and git indexes:
+#
+#     check.sh WC
+#
+# Prints each check that fails, and exits with 1 if any did.
+
+set -eu
+
+if (($# != 1)); then
+    echo "usage: $0 WC" >&2
+    exit 2
+fi
+
+wc=$(realpath "$1")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+export UBSAN_OPTIONS=halt_on_error=1
+failures=0
+
+fail() {
+    echo "FAIL: $*" >&2
+    failures=$((failures + 1))
+}
+
+# Runs WC with the arguments given, and fails unless it exits with 0 or 1
+# without a sanitizer report, or, if EXPECTED is not empty, unless its
+# standard error contains EXPECTED.
+expect_clean() {
+    local expected=$1
+    shift
+    local status=0
+
+    "$wc" "$@" >"$dir/out" 2>"$dir/err" </dev/null || status=$?
+
+    if ((status > 1)) || grep -q 'runtime error\|Sanitizer' "$dir/err"; then
+        fail "exit status $status: wc $*"
+    elif [[ -n $expected ]] && ! grep -q "$expected" "$dir/err"; then
+        fail "no '$expected': wc $*"
+    fi
+}
+
+# Writes the first SIZE bytes of FILE to FILE.SIZE.
+cut_file() {
+    head -c "$2" "$1" >"$1.$2"
+}
+
+# Writes FILE with 8 bytes from OFFSET on overwritten to FILE.corrupt.
+corrupt_file() {
+    cp "$1" "$1.corrupt"
+    printf '\377\000\377\000\377\000\377\000' |
+        dd of="$1.corrupt" bs=1 seek="$2" conv=notrunc status=none
+}
+
+cd "$dir"
+
+awk 'BEGIN {
+    srand(1)
+    split("the quick brown fox jumps over the lazy dog héllo naïve 42 3.14", w)
+    for (i = 0; i < 100000; ++i) {
+        printf "2024-01-%02dT%02d:%02d:00Z", i % 28 + 1, i % 24, i % 60
+        for (j = int(rand() * 12); j > 0; --j) {
+            printf " %s", w[int(rand() * 14) + 1]
+        }
+        printf "\n"
+    }
+}' >text.log
+awk 'BEGIN {
+    for (i = 0; i < 100000; ++i) {
+        printf "%d,\"a, \"\"b\"\"\nc\",d%s\n", i, i % 7 == 0 ? ",e" : ""
+    }
+}' >data.csv
+awk 'BEGIN {
+    for (i = 0; i < 100000; ++i) {
+        printf "{\"n\": %d, \"s\": \"a\\\"{[\\\\\", \"a\": [%s]}\n", i,
+            i % 5 == 0 ? "{}" : ""
+        if (i % 1000 == 0) {
+            printf "{\"bad\": [}\n\n"
+        }
+    }
+}' >data.jsonl
+awk 'BEGIN {
+    for (i = 0; i < 50000; ++i) {
+        printf "/* %d\n * comment */\nint f%d() { return %d; } // end\n\n", i, i, i
+    }
+}' >code.c
+gzip -c text.log >text.log.gz
+xz -c text.log >text.log.xz
+tar cf files.tar text.log data.csv data.jsonl code.c
+gzip -c files.tar >files.tgz
+
+if command -v zip >/dev/null; then
+    zip -q files.zip text.log data.csv data.jsonl code.c
+    zip -q -0 stored.zip text.log data.csv
+fi
+
+# The same counts with one job and with four, from files and standard input.
+while read -r file options; do
+    for input in file stdin; do
+        if [[ $input == file ]]; then
+            one=$("$wc" -j1 $options "$file" 2>&1) || true
+            four=$("$wc" -j4 $options "$file" 2>&1) || true
+        else
+            one=$("$wc" -j1 $options <"$file" 2>&1) || true
+            four=$("$wc" -j4 $options <"$file" 2>&1) || true
+        fi
+
+        if [[ $one != "$four" ]]; then
+            fail "-j1 and -j4 differ from $input: wc $options $file"
+        fi
+    done
+done <<EOF
+text.log
+text.log -L
+text.log --tokens
+text.log --distinct-lines
+text.log --approx-distinct=words
+text.log --top-words=10
+text.log --bucket-by-time=iso,1h
+text.log --hash=crc32c
+text.log --hash=xxh3
+data.csv --csv
+data.jsonl --jsonl
+code.c --sloc
+text.log.gz -z
+text.log.xz -z
+files.tar --tar
+files.tgz --tar
+EOF
+
+for archive in files.zip stored.zip; do
+    if [[ -f $archive ]] &&
+        [[ $("$wc" -j1 --zip "$archive" 2>&1) != $("$wc" -j4 --zip "$archive" 2>&1) ]]; then
+        fail "-j1 and -j4 differ: wc --zip $archive"
+    fi
+done
+
+# Truncated and corrupt archives.
+for archive in text.log.gz:-z text.log.xz:-z files.tar:--tar files.tgz:--tar \
+    files.zip:--zip stored.zip:--zip; do
+    file=${archive%%:*}
+    option=${archive#*:}
+
+    if [[ ! -f $file ]]; then
+        continue
+    fi
+
+    size=$(stat -c %s "$file")
+
+    for cut in 0 10 100 512 $((size / 2)) $((size - 1)); do
+        cut_file "$file" "$cut"
+
+        for jobs in 1 4; do
+            expect_clean '' -j"$jobs" "$option" "$file.$cut"
+        done
+    done
+
+    for offset in 0 20 $((size / 2)) $((size - 30)); do
+        corrupt_file "$file" "$offset"
+
+        for jobs in 1 4; do
+            expect_clean '' -j"$jobs" "$option" "$file.corrupt"
+        done
+    done
+done
+
+for cut in 10 $(($(stat -c %s text.log.gz) / 2)); do
+    expect_clean 'error' -z text.log.gz."$cut"
+done
+
+# Truncated and corrupt git indexes, of each version. Cuts at bytes 76 and 80
+# fall in the name of the first entry, ab, and in its padding or the next
+# entry.
+git init -q repo
+cd repo
+printf 'one\n' >ab
+printf 'two words\n' >cd
+git add ab cd
+
+for version in 2 3 4; do
+    git update-index --index-version "$version"
+    cp .git/index ../index
+
+    if ! "$wc" --git >/dev/null 2>&1; then
+        fail "index version $version not read"
+    fi
+
+    for ((cut = 0; cut < $(stat -c %s ../index); ++cut)); do
+        head -c "$cut" ../index >.git/index
+        expect_clean '' --git
+    done
+
+    for cut in 12 76 80; do
+        head -c "$cut" ../index >.git/index
+        expect_clean 'malformed index' --git
+    done
+
+    cp ../index .git/index
+    printf '\377\377\377\377' | dd of=.git/index bs=1 seek=8 conv=notrunc status=none
+    expect_clean 'malformed index' --git
+
+    cp ../index .git/index
+done
+
+cd ..
+
+if ((failures != 0)); then
+    echo "$failures check(s) failed" >&2
+    exit 1
+fi
+
+echo "all checks passed"
@@ -1,38 +1,186 @@
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <expected>
 #include <filesystem>
 #include <format>
 #include <fstream>
+#include <future>
 #include <iostream>
 #include <locale>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <system_error>
+#include <thread>
+#include <vector>
 
+#include <cctype>
+#include <climits>
 #include <clocale>
+#include <cmath>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
+#include <fcntl.h>
 #include <getopt.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
 #include <unistd.h>
 
+#include <lzma.h>
+#include <zlib.h>
+
+#if defined(WITH_ZSTD)
+#include <zstd.h>
+#endif
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 namespace fs = std::filesystem;
 
+enum class ApproxDistinct {
+    none,
+    lines,
+    words
+};
+
+enum class HashAlgorithm {
+    none,
+    crc32c,
+    xxh3
+};
+
 struct Options {
     bool count_bytes {false};
     bool count_lines {false};
     bool count_words {false};
     bool count_max_line_length {false};
+    bool count_csv {false};
+    bool count_jsonl {false};
+    bool count_sloc {false};
+    bool count_distinct_lines {false};
+    std::size_t distinct_memory {0}; /* 0 for no limit. */
+    ApproxDistinct approx_distinct {ApproxDistinct::none};
+    unsigned hll_precision {14};
+    const char* sketch_out {nullptr};
+    std::vector<const char*> sketch_in {};
+    std::size_t top_words {0};
+    std::size_t top_words_sketch {0}; /* Width of the sketch, or 0. */
+    bool count_tokens {false};
+    const char* token_vocabulary {nullptr};
+
+    std::string_view bucket_format {};
+    std::int64_t bucket_width {0}; /* In seconds, 0 for no buckets. */
+    HashAlgorithm hash {HashAlgorithm::none};
+    bool decompress {false};
+    bool tar {false};
+    bool zip {false};
+    bool dedup_total {false};
+    bool dedup_extents {false};
+    bool git {false};
+
+    /* Loaded from token_vocabulary by main(). */
+    std::shared_ptr<const class BpeVocabulary> vocabulary {};
+    bool recursive {false};
+    unsigned jobs {1};
+    std::size_t buffer_size {0}; /* 0 to adapt it to the throughput. */
+    std::size_t max_memory {0}; /* 0 for no limit. */
+
+    /* Made by main(). */
+    std::shared_ptr<class MemoryBudget> budget {};
+    std::shared_ptr<class BufferPool> buffers {};
+    std::shared_ptr<class SizeTuner> tuner {};
 };
 
+struct ArchiveMember;
+
 struct FileStatistics {
     std::uintmax_t lines {0};
     std::uintmax_t words {0};
     std::uintmax_t bytes {0};
     std::uintmax_t max_line_length {0};
+    std::uintmax_t csv_records {0};
+    std::uintmax_t csv_min_fields {0};
+    std::uintmax_t csv_max_fields {0};
+    std::uintmax_t jsonl_records {0};
+    std::uintmax_t jsonl_empty {0};
+    std::uintmax_t jsonl_malformed {0};
+    std::uintmax_t jsonl_first_malformed {UINTMAX_MAX};
+    std::uintmax_t sloc_code {0};
+    std::uintmax_t sloc_comment {0};
+    std::uintmax_t sloc_blank {0};
+    int sloc_language {-1}; /* Index in languages, or -1 if unknown. */
+    std::uintmax_t distinct_lines {0};
+
+    /* The set of lines of the input, kept for the total of --distinct-lines
+     * when there is more than one input. */
+    std::shared_ptr<class DistinctLines> distinct {};
+    std::uintmax_t approx_distinct {0};
+    std::shared_ptr<class HyperLogLog> sketch {};
+    std::shared_ptr<class WordFrequencies> word_frequencies {};
+    std::uintmax_t tokens {0};
+    std::shared_ptr<struct TimeBuckets> buckets {};
+    std::optional<std::uint64_t> hash {}; /* None for totals. */
+    std::uintmax_t compressed_bytes {0};
+
+    /* The members of a --tar archive, in order, which these are the sums of. */
+    std::shared_ptr<std::vector<ArchiveMember>> members {};
+};
+
+struct ArchiveMember {
+    std::string name;
+    FileStatistics stats;
 };
 
 enum class ParseOptionsError { 
     help_requested, 
-    unknown_option 
+    unknown_option,
+    invalid_argument
+};
+
+/* Long options without a short equivalent. */
+enum LongOption : int {
+    opt_csv = 256,
+    opt_jsonl,
+    opt_sloc,
+    opt_distinct_lines,
+    opt_distinct_memory,
+    opt_approx_distinct,
+    opt_hll_precision,
+    opt_sketch_out,
+    opt_sketch_in,
+    opt_top_words,
+    opt_top_words_sketch,
+    opt_tokens,
+    opt_token_vocabulary,
+    opt_bucket_by_time,
+    opt_hash,
+    opt_tar,
+    opt_zip,
+    opt_dedup_total,
+    opt_dedup_extents,
+    opt_buffer_size,
+    opt_max_memory,
+    opt_git,
 };
 
 static auto help(std::ostream& os, std::string_view argv0) -> void 
@@ -68,6 +216,135 @@ OPTION:
     -l, --lines                 print the newline counts.
     -L, --max-line-length       print the maximum display width.
     -w, --words                 print the word counts.
+        --csv                   print the number of CSV records, and the
+                                minimum and maximum number of fields per
+                                record. Quoted fields may contain commas and
+                                newlines, as per RFC 4180. Empty lines are not
+                                records.
+        --jsonl                 print the number of JSON Lines records, empty
+                                lines, and malformed records. A record is
+                                malformed if its brackets or braces do not
+                                balance, or if it has an unterminated string,
+                                or a control character or bad escape in a
+                                string. The byte offset of the first malformed
+                                record is written to standard error.
+        --sloc                  print the number of lines of code, comment
+                                lines and blank lines, using the comment
+                                syntax of the language of the file, as given
+                                by its extension. Totals for each language
+                                follow the total line.
+        --distinct-lines        print the number of distinct lines. The total
+                                line gives the number of distinct lines across
+                                all the files.
+        --distinct-memory=SIZE  when the lines kept by --distinct-lines take
+                                more than SIZE bytes, move them to temporary
+                                files, split by hash, and count each part on
+                                its own at the end. SIZE may end with K, M, G
+                                or T, and is at least 1M. The default is no
+                                limit.
+        --approx-distinct=WHAT  print an estimate of the number of distinct
+                                lines or words, as WHAT is lines or words,
+                                from a HyperLogLog sketch.
+        --hll-precision=P       use 2^P registers in the sketch, for P in 4
+                                to 18. The default is 14, which takes 16 KiB,
+                                for a standard error of about 0.8%.
+        --sketch-out=FILE       write the sketch of all the inputs to FILE.
+        --sketch-in=FILE        merge the sketch saved in FILE into the total
+                                line, which is then always printed. May be
+                                given more than once.
+        --top-words=K           after the counts, print the K most frequent
+                                words of all the inputs, with their number of
+                                occurrences.
+        --top-words-sketch[=WIDTH]
+                                count words in a count-min sketch of 4 rows of
+                                WIDTH counters, and only keep the most frequent
+                                words, so that memory is bounded. Counts may
+                                then be overestimated. The default WIDTH is
+                                262144.
+        --tokens                print an estimate of the number of tokens of a
+                                language model: the number of pieces that the
+                                GPT-2 pre-tokenizer splits the input into, on
+                                runs of letters, digits, other characters and
+                                white space. Characters that are not ASCII
+                                count as letters.
+        --token-vocabulary=FILE with --tokens, split each piece further by
+                                byte pair encoding, with the ranked tokens of
+                                FILE, in the format of tiktoken.
+        --bucket-by-time=FORMAT,WIDTH
+                                after the counts, print the lines, words and
+                                bytes of all the inputs by periods of WIDTH
+                                seconds, or minutes, hours or days if WIDTH
+                                ends with m, h or d, as per the timestamp that
+                                starts each line. FORMAT is iso, for ISO 8601,
+                                or a format of strptime() with %Y, %m, %d, %e,
+                                %b, %H, %M, %S, %z and %s. Lines without a
+                                timestamp count in the period of the one
+                                before, or else in a period named none.
+                                Periods start on multiples of WIDTH since the
+                                epoch, in UTC if timestamps have a zone.
+        --hash=ALGORITHM        print a checksum of the bytes, in hexadecimal,
+                                as ALGORITHM is crc32c, for CRC-32C
+                                (Castagnoli), or xxh3, for the 64-bit XXH3
+                                hash. The total line has none.
+    -z, --decompress            count the content of files compressed with
+                                gzip or xz, or zstd if built with WITH_ZSTD,
+                                as told by their first bytes. With -c, the
+                                number of bytes of the files follows the byte
+                                count.
+                                With -j, BGZF files and zstd files of several
+                                frames are decompressed in parallel.
+        --tar                   count each member of tar archives, which may
+                                be compressed as with -z, in a line named
+                                ARCHIVE(MEMBER), followed by the sums of the
+                                archive. Only regular files are counted.
+        --zip                   count each file of zip archives, such as jar
+                                files, as with --tar, as listed by their
+                                central directory. Files may be stored or
+                                compressed with deflate; with -j, they are
+                                inflated in parallel.
+    -r, --recursive             count the files in directories, recursively.
+        --dedup-total           count the files that are the same file as an
+                                earlier argument, such as hard links or
+                                files found twice by -r, once in the total.
+                                Such files are only read once in any case,
+                                but printed for every argument.
+        --dedup-extents         also take files whose data is in the same
+                                physical extents as the same file, such as
+                                reflinked copies on btrfs or XFS, as found by
+                                FIEMAP.
+        --git                   count the files tracked by git under the FILE
+                                arguments, or the current directory, which may
+                                be anywhere in a work tree, as listed by its
+                                index, with one job per available CPU
+                                unless -j is given. The counts of files whose
+                                stat data is still that of the index are kept
+                                in the file wc-cache of the git directory, by
+                                content, and reused while it stays so, unless
+                                --distinct-lines, --approx-distinct,
+                                --top-words, --token-vocabulary,
+                                --bucket-by-time, -z, --tar or --zip is given.
+    -j, --jobs=N                count files, and large regular files and block
+                                devices in chunks, with N parallel jobs.
+                                Results are still printed in argument order.
+                                0 uses one job per available CPU.
+        --buffer-size=SIZE      read files that are not mapped into memory
+                                SIZE bytes at a time, rounded up to a multiple
+                                of 4 KiB. SIZE may end with K, M or G, and is
+                                at most 1G. By default, the size of reads is
+                                adapted to the throughput measured on each
+                                device, between 64K and 16M.
+        --max-memory=SIZE       keep the memory taken by read and decompression
+                                buffers, the results of files counted ahead of
+                                their turn by -j, the lines kept by
+                                --distinct-lines and the sketches of
+                                --top-words-sketch to about SIZE. Past it,
+                                fewer files are counted ahead, threads wait for
+                                buffers to be free, and --distinct-lines moves
+                                lines to temporary files as with
+                                --distinct-memory. The words of --top-words and
+                                the cache of --token-vocabulary are not
+                                counted. SIZE may end with K, M, G or T. The
+                                default is no limit.
     -h, --help                  display this help and exit.
 
 EXIT STATUS:
@@ -89,6 +366,17 @@ static auto read_err(std::ostream& os, const std::string_view& file) -> void
         std::error_code {errno, std::generic_category()}.message());
 }
 
+static auto report_malformed(std::ostream& os,
+                             const Options& options,
+                             const FileStatistics& stats,
+                             std::string_view file) -> void 
+{
+    if (options.count_jsonl and stats.jsonl_malformed != 0) {
+        os << std::format("wc: {}: first malformed record at byte offset {}.\n",
+                          file, stats.jsonl_first_malformed);
+    }
+}
+
 static auto chkd_add(std::uintmax_t& res, std::uintmax_t a, std::uintmax_t b)
     -> bool {
     if (a + b < a) {
@@ -99,6 +387,64 @@ static auto chkd_add(std::uintmax_t& res, std::uintmax_t a, std::uintmax_t b)
     return true;
 }
 
+[[nodiscard]] static auto parse_unsigned(std::string_view s)
+    -> std::optional<std::uintmax_t> 
+{
+    if (s.empty()) {
+        return std::nullopt;
+    }
+
+    std::uintmax_t n {0};
+
+    for (const char c : s) {
+        if (c < '0' or c > '9' or n > (UINTMAX_MAX - 9) / 10) {
+            return std::nullopt;
+        }
+        n = n * 10 + static_cast<std::uintmax_t>(c - '0');
+    }
+    return n;
+}
+
+/* Parses a byte count, optionally followed by K, M, G or T (powers of 1024),
+ * and then optionally by B or iB. */
+[[nodiscard]] static auto parse_size(std::string_view s)
+    -> std::optional<std::size_t> 
+{
+    const auto digits {s.find_first_not_of("0123456789")};
+    const auto n {parse_unsigned(s.substr(0, digits))};
+
+    if (not n) {
+        return std::nullopt;
+    }
+
+    auto suffix {digits == s.npos ? std::string_view {} : s.substr(digits)};
+    unsigned shift {0};
+
+    if (not suffix.empty()) {
+        const auto units {std::string_view {"KMGT"}};
+        const auto unit {units.find(static_cast<char>(std::toupper(
+            static_cast<unsigned char>(suffix.front()))))};
+
+        if (unit != units.npos) {
+            shift = 10 * static_cast<unsigned>(unit + 1);
+            suffix.remove_prefix(1);
+
+            if (suffix == "iB") {
+                suffix = {};
+            }
+        }
+
+        if (suffix != "" and suffix != "B") {
+            return std::nullopt;
+        }
+    }
+
+    if (*n > (SIZE_MAX >> shift)) {
+        return std::nullopt;
+    }
+    return *n << shift;
+}
+
 static auto write_counts(std::ostream& os, 
                          const Options& options,
                          const FileStatistics& stats, 
@@ -120,10 +466,51 @@ static auto write_counts(std::ostream& os,
         os << std::format("  {:>7L}", stats.bytes);
     }
 
+    if (options.count_bytes and options.decompress) {
+        os << std::format("  {:>7L}", stats.compressed_bytes);
+    }
+
     if (options.count_max_line_length) {
         os << std::format("  {:>7L}", stats.max_line_length);
     }
 
+    if (options.count_csv) {
+        os << std::format("  {:>7L}  {:>7L}  {:>7L}", stats.csv_records,
+                          stats.csv_min_fields, stats.csv_max_fields);
+    }
+
+    if (options.count_jsonl) {
+        os << std::format("  {:>7L}  {:>7L}  {:>7L}", stats.jsonl_records,
+                          stats.jsonl_empty, stats.jsonl_malformed);
+    }
+
+    if (options.count_sloc) {
+        os << std::format("  {:>7L}  {:>7L}  {:>7L}", stats.sloc_code,
+                          stats.sloc_comment, stats.sloc_blank);
+    }
+
+    if (options.count_distinct_lines) {
+        os << std::format("  {:>7L}", stats.distinct_lines);
+    }
+
+    if (options.approx_distinct != ApproxDistinct::none) {
+        os << std::format("  {:>7L}", stats.approx_distinct);
+    }
+
+    if (options.count_tokens) {
+        os << std::format("  {:>7L}", stats.tokens);
+    }
+
+    if (options.hash != HashAlgorithm::none) {
+        const int digits {options.hash == HashAlgorithm::crc32c ? 8 : 16};
+
+        if (stats.hash) {
+            os << std::format("  {:0{}x}", *stats.hash, digits);
+        } else {
+            os << std::format("  {:>{}}", "-", digits);
+        }
+    }
+
     if (file) {
         os << std::format("  {}", file);
     }
@@ -133,21 +520,50 @@ static auto write_counts(std::ostream& os,
     os << '\n' << std::flush;
 }
 
+/* The conversions that --bucket-by-time formats may have after a %. */
+constexpr std::string_view time_conversions {"YmdebHMSzs%"};
+
 [[nodiscard]] static auto parse_options(int argc, char* argv[])
     -> std::expected<Options, ParseOptionsError> 
 {
     auto options {Options {}};
+    bool jobs_given {false};
 
     static constexpr const ::option long_options[] {
         {"bytes", no_argument, nullptr, 'c'},
         {"lines", no_argument, nullptr, 'l'},
         {"max-line-length", no_argument, nullptr, 'L'},
         {"words", no_argument, nullptr, 'w'},
+        {"csv", no_argument, nullptr, opt_csv},
+        {"jsonl", no_argument, nullptr, opt_jsonl},
+        {"sloc", no_argument, nullptr, opt_sloc},
+        {"distinct-lines", no_argument, nullptr, opt_distinct_lines},
+        {"distinct-memory", required_argument, nullptr, opt_distinct_memory},
+        {"approx-distinct", required_argument, nullptr, opt_approx_distinct},
+        {"hll-precision", required_argument, nullptr, opt_hll_precision},
+        {"sketch-out", required_argument, nullptr, opt_sketch_out},
+        {"sketch-in", required_argument, nullptr, opt_sketch_in},
+        {"top-words", required_argument, nullptr, opt_top_words},
+        {"top-words-sketch", optional_argument, nullptr, opt_top_words_sketch},
+        {"tokens", no_argument, nullptr, opt_tokens},
+        {"token-vocabulary", required_argument, nullptr, opt_token_vocabulary},
+        {"bucket-by-time", required_argument, nullptr, opt_bucket_by_time},
+        {"hash", required_argument, nullptr, opt_hash},
+        {"tar", no_argument, nullptr, opt_tar},
+        {"zip", no_argument, nullptr, opt_zip},
+        {"dedup-total", no_argument, nullptr, opt_dedup_total},
+        {"dedup-extents", no_argument, nullptr, opt_dedup_extents},
+        {"git", no_argument, nullptr, opt_git},
+        {"decompress", no_argument, nullptr, 'z'},
+        {"recursive", no_argument, nullptr, 'r'},
+        {"jobs", required_argument, nullptr, 'j'},
+        {"buffer-size", required_argument, nullptr, opt_buffer_size},
+        {"max-memory", required_argument, nullptr, opt_max_memory},
         {"help", no_argument, nullptr, 'h'},
         {nullptr, 0, nullptr, 0}};
 
     while (true) {
-        const int c {::getopt_long(argc, argv, "clLwh", long_options, nullptr)};
+        const int c {::getopt_long(argc, argv, "clLwzrj:h", long_options, nullptr)};
 
         if (c == -1) {
             break;
@@ -170,198 +586,7813 @@ static auto write_counts(std::ostream& os,
             options.count_words = true;
             break;
 
-        case 'h':
-            return std::unexpected {ParseOptionsError::help_requested};
+        case opt_csv:
+            options.count_csv = true;
+            break;
 
-            /* case '?' */
-        default:
-            return std::unexpected {ParseOptionsError::unknown_option};
+        case opt_jsonl:
+            options.count_jsonl = true;
+            break;
+
+        case opt_sloc:
+            options.count_sloc = true;
+            break;
+
+        case opt_distinct_lines:
+            options.count_distinct_lines = true;
+            break;
+
+        case opt_distinct_memory: {
+            const auto size {parse_size(optarg)};
+
+            if (not size) {
+                std::cerr << std::format("wc: invalid memory size: '{}'\n",
+                                         optarg);
+                return std::unexpected {ParseOptionsError::invalid_argument};
+            }
+
+            options.distinct_memory = *size;
+            break;
         }
-    }
-    return options;
-}
 
-[[nodiscard]] static auto wc(const Options& options, std::istream& is)
-    -> std::expected<FileStatistics, bool> 
-{
-    auto stats {FileStatistics {}};
-    constexpr std::size_t bufsize {262144};
-    char buf[bufsize];
-    [[maybe_unused]] bool in_word {false};
+        case opt_approx_distinct:
+            if (std::string_view {optarg} == "lines") {
+                options.approx_distinct = ApproxDistinct::lines;
+            } else if (std::string_view {optarg} == "words") {
+                options.approx_distinct = ApproxDistinct::words;
+            } else {
+                std::cerr << std::format(
+                    "wc: invalid argument to --approx-distinct: '{}'\n", optarg);
+                return std::unexpected {ParseOptionsError::invalid_argument};
+            }
+            break;
 
-    std::uintmax_t line_pos {0};
-    constexpr std::size_t tab_width {8};
+        case opt_hll_precision: {
+            const auto precision {parse_unsigned(optarg)};
 
-    while (is) {
-        is.read(buf, bufsize);
-        const auto count {static_cast<std::size_t>(is.gcount())};
+            if (not precision or *precision < 4 or *precision > 18) {
+                std::cerr << std::format("wc: invalid precision: '{}'\n",
+                                         optarg);
+                return std::unexpected {ParseOptionsError::invalid_argument};
+            }
 
-        if (count == 0) {
+            options.hll_precision = static_cast<unsigned>(*precision);
+            break;
+        }
+
+        case opt_sketch_out:
+            options.sketch_out = optarg;
+            break;
+
+        case opt_sketch_in:
+            options.sketch_in.push_back(optarg);
+            break;
+
+        case opt_top_words: {
+            const auto k {parse_unsigned(optarg)};
+
+            if (not k or *k == 0 or *k > SIZE_MAX / 64) {
+                std::cerr << std::format("wc: invalid number of words: '{}'\n",
+                                         optarg);
+                return std::unexpected {ParseOptionsError::invalid_argument};
+            }
+
+            options.top_words = *k;
             break;
         }
 
-        stats.bytes += count;
+        case opt_top_words_sketch: {
+            const auto width {optarg ? parse_unsigned(optarg) : 262144};
 
-        if (options.count_lines or options.count_max_line_length or
-            options.count_words) {
-            for (std::size_t i {0}; i < count; ++i) {
-                const auto c {static_cast<unsigned char>(buf[i])};
+            if (not width or *width == 0 or *width > (std::uintmax_t {1} << 32)) {
+                std::cerr << std::format("wc: invalid sketch width: '{}'\n",
+                                         optarg);
+                return std::unexpected {ParseOptionsError::invalid_argument};
+            }
+
+            options.top_words_sketch = std::bit_ceil(*width);
+            break;
+        }
+
+        case opt_tokens:
+            options.count_tokens = true;
+            break;
+
+        case opt_token_vocabulary:
+            options.token_vocabulary = optarg;
+            break;
 
-                switch (c) {
-                case '\n':
-                    ++stats.lines;
-                    [[fallthrough]];
+        case opt_bucket_by_time: {
+            const auto arg {std::string_view {optarg}};
+            const auto comma {arg.rfind(',')};
+            const auto format {arg.substr(0, comma)};
+            auto width {comma == arg.npos ? std::string_view {}
+                                          : arg.substr(comma + 1)};
+            std::int64_t unit {1};
 
-                case '\r':
-                case '\f':
-                    stats.max_line_length =
-                        std::max(line_pos, stats.max_line_length);
-                    line_pos = 0;
-                    in_word = false;
-                    break;
+            if (width.ends_with('m')) {
+                unit = 60;
+            } else if (width.ends_with('h')) {
+                unit = 3600;
+            } else if (width.ends_with('d')) {
+                unit = 86400;
+            }
 
-                case '\t':
-                    line_pos += tab_width - (line_pos % tab_width);
-                    in_word = false;
-                    break;
+            if (unit != 1 or width.ends_with('s')) {
+                width.remove_suffix(1);
+            }
 
-                case ' ':
-                    ++line_pos;
-                    [[fallthrough]];
+            const auto n {parse_unsigned(width)};
 
-                case '\v':
-                    in_word = false;
-                    break;
+            if (not n or *n == 0 or *n > INT64_MAX / 86400 / 1000) {
+                std::cerr << std::format("wc: invalid bucket width: '{}'\n",
+                                         optarg);
+                return std::unexpected {ParseOptionsError::invalid_argument};
+            }
 
-                default:
-                    line_pos += isprint(c) != 0;
-                    const bool in_word2 = !isspace(c);
-                    stats.words += !in_word & in_word2;
-                    in_word = in_word2;
-                    break;
+            for (std::size_t i {0}; i < format.size() and format != "iso"; ++i) {
+                if (format[i] == '%' and
+                    (i + 1 == format.size() or 
+                     time_conversions.find(format[++i]) == time_conversions.npos)) {
+                    std::cerr << std::format("wc: invalid time format: '{}'\n",
+                                             format);
+                    return std::unexpected {ParseOptionsError::invalid_argument};
                 }
             }
+
+            options.bucket_format = format;
+            options.bucket_width = static_cast<std::int64_t>(*n) * unit;
+            break;
+        }
+
+        case opt_hash:
+            if (std::string_view {optarg} == "crc32c") {
+                options.hash = HashAlgorithm::crc32c;
+            } else if (std::string_view {optarg} == "xxh3") {
+                options.hash = HashAlgorithm::xxh3;
+            } else {
+                std::cerr << std::format(
+                    "wc: invalid argument to --hash: '{}'\n", optarg);
+                return std::unexpected {ParseOptionsError::invalid_argument};
+            }
+            break;
+
+        case opt_tar:
+            options.tar = true;
+            break;
+
+        case opt_zip:
+            options.zip = true;
+            break;
+
+        case opt_dedup_total:
+            options.dedup_total = true;
+            break;
+
+        case opt_dedup_extents:
+            options.dedup_extents = true;
+            break;
+
+        case opt_git:
+            options.git = true;
+            break;
+
+        case opt_buffer_size: {
+            const auto size {parse_size(optarg)};
+
+            if (not size or *size == 0 or *size > std::size_t {1} << 30) {
+                std::cerr << std::format("wc: invalid buffer size: '{}'\n",
+                                         optarg);
+                return std::unexpected {ParseOptionsError::invalid_argument};
+            }
+
+            options.buffer_size = *size;
+            break;
+        }
+
+        case opt_max_memory: {
+            const auto size {parse_size(optarg)};
+
+            if (not size or *size == 0) {
+                std::cerr << std::format("wc: invalid memory size: '{}'\n",
+                                         optarg);
+                return std::unexpected {ParseOptionsError::invalid_argument};
+            }
+
+            options.max_memory = *size;
+            break;
+        }
+
+        case 'z':
+            options.decompress = true;
+            break;
+
+        case 'r':
+            options.recursive = true;
+            break;
+
+        case 'j': {
+            const auto jobs {parse_unsigned(optarg)};
+
+            if (not jobs or *jobs > 4096) {
+                std::cerr << std::format("wc: invalid number of jobs: '{}'\n",
+                                         optarg);
+                return std::unexpected {ParseOptionsError::invalid_argument};
+            }
+
+            options.jobs = *jobs != 0
+                ? static_cast<unsigned>(*jobs)
+                : std::max(std::thread::hardware_concurrency(), 1U);
+            jobs_given = true;
+            break;
+        }
+
+        case 'h':
+            return std::unexpected {ParseOptionsError::help_requested};
+
+            /* case '?' */
+        default:
+            return std::unexpected {ParseOptionsError::unknown_option};
         }
     }
 
-    stats.max_line_length = std::max(line_pos, stats.max_line_length);
+    if (options.top_words_sketch != 0 and options.top_words == 0) {
+        std::cerr << "wc: --top-words-sketch requires --top-words.\n";
+        return std::unexpected {ParseOptionsError::invalid_argument};
+    }
 
-    if (is.bad()) {
-        return std::unexpected {false};
+    if (options.token_vocabulary and not options.count_tokens) {
+        std::cerr << "wc: --token-vocabulary requires --tokens.\n";
+        return std::unexpected {ParseOptionsError::invalid_argument};
     }
-    return stats;
+
+    if ((options.sketch_out or not options.sketch_in.empty()) and
+        options.approx_distinct == ApproxDistinct::none) {
+        std::cerr << "wc: --sketch-in and --sketch-out require --approx-distinct.\n";
+        return std::unexpected {ParseOptionsError::invalid_argument};
+    }
+
+    if (options.tar and options.zip) {
+        std::cerr << "wc: --tar and --zip cannot be combined.\n";
+        return std::unexpected {ParseOptionsError::invalid_argument};
+    }
+
+    if (options.git and options.recursive) {
+        std::cerr << "wc: --git and -r cannot be combined.\n";
+        return std::unexpected {ParseOptionsError::invalid_argument};
+    }
+
+    if (options.git and not jobs_given) {
+        options.jobs = std::max(std::thread::hardware_concurrency(), 1U);
+    }
+    return options;
 }
 
-[[nodiscard]] static auto wc_file(const Options& options, 
-                                  std::istream& is,
-                                  const char* file, 
-                                  int nfiles,
-                                  FileStatistics& total_stats) -> int 
+/* Returns a bitmask of the bytes of the 64-byte block at p that are equal to
+ * c; bit i corresponds to p[i]. */
+[[nodiscard]] static auto match64(const char* p, char c) -> std::uint64_t 
 {
-    auto const stats {wc(options, is)};
+#if defined(__SSE2__)
+    const auto needle {_mm_set1_epi8(c)};
+    std::uint64_t mask {0};
 
-    if (not stats) {
-        read_err(std::cerr, file);
-        return EXIT_SUCCESS; /* We only want to exit on overflow. */
+    for (int i {0}; i < 4; ++i) {
+        const auto v {_mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(p + 16 * i))};
+        const auto bits {static_cast<std::uint32_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)))};
+        mask |= std::uint64_t {bits} << (16 * i);
     }
+    return mask;
+#else
+    std::uint64_t mask {0};
 
-    write_counts(std::cout, options, stats.value(), file);
+    for (std::size_t i {0}; i < 64; ++i) {
+        mask |= std::uint64_t {p[i] == c} << i;
+    }
+    return mask;
+#endif
+}
 
-    if (nfiles > 1) {
-        total_stats.max_line_length =
-            std::max(stats->max_line_length, total_stats.max_line_length);
+/* Returns a bitmask of the bytes of the 64-byte block at p that are less than
+ * limit, compared as unsigned. */
+[[nodiscard]] static auto below64(const char* p, unsigned char limit)
+    -> std::uint64_t 
+{
+#if defined(__SSE2__)
+    const auto max {_mm_set1_epi8(static_cast<char>(limit - 1))};
+    std::uint64_t mask {0};
 
-        if (!chkd_add(total_stats.lines, total_stats.lines, stats->lines)) {
-            std::cerr << "Error: integer overflow in total lines.\n";
-            return EXIT_FAILURE;
-        } else if (!chkd_add(total_stats.words, total_stats.words,
-                             stats->words)) {
-            std::cerr << "Error: integer overflow in total words.\n";
-            return EXIT_FAILURE;
-        } else if (!chkd_add(total_stats.bytes, total_stats.bytes,
-                             stats->bytes)) {
-            std::cerr << "Error: integer overflow in total bytes.\n";
-            return EXIT_FAILURE;
-        }
+    for (int i {0}; i < 4; ++i) {
+        const auto v {_mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(p + 16 * i))};
+        const auto bits {static_cast<std::uint32_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, max), max)))};
+        mask |= std::uint64_t {bits} << (16 * i);
     }
-    return EXIT_SUCCESS;
+    return mask;
+#else
+    std::uint64_t mask {0};
+
+    for (std::size_t i {0}; i < 64; ++i) {
+        mask |= std::uint64_t {static_cast<unsigned char>(p[i]) < limit} << i;
+    }
+    return mask;
+#endif
 }
 
-[[nodiscard]] static auto wc_file(const Options& options,
-                                  std::istream& is,
-                                  const char* file) -> int 
+/* Returns a bitmask of the bytes of the 64-byte block at p that are in
+ * [lo, hi], compared as unsigned. */
+[[nodiscard]] static auto range64(const char* p, unsigned char lo,
+                                  unsigned char hi) -> std::uint64_t 
 {
-    auto const stats {wc(options, is)};
+#if defined(__SSE2__)
+    const auto offset {_mm_set1_epi8(static_cast<char>(lo))};
+    const auto max {_mm_set1_epi8(static_cast<char>(hi - lo))};
+    std::uint64_t mask {0};
 
-    if (not stats) {
-        read_err(std::cerr, file);
-        return EXIT_FAILURE;
+    for (int i {0}; i < 4; ++i) {
+        const auto v {_mm_sub_epi8(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * i)),
+            offset)};
+        const auto bits {static_cast<std::uint32_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, max), max)))};
+        mask |= std::uint64_t {bits} << (16 * i);
     }
+    return mask;
+#else
+    std::uint64_t mask {0};
 
-    write_counts(std::cout, options, stats.value(), nullptr);
+    for (std::size_t i {0}; i < 64; ++i) {
+        const auto c {static_cast<unsigned char>(p[i])};
 
-    return EXIT_SUCCESS;
+        mask |= std::uint64_t {c >= lo and c <= hi} << i;
+    }
+    return mask;
+#endif
 }
 
-auto main(int argc, char* argv[]) -> int 
+/* Calls block(p, n) for each successive block of at most 64 bytes of data. The
+ * last block is copied to a buffer padded with NULs, so that p always points
+ * to 64 readable bytes. */
+template <typename F>
+static auto for_each_block(std::span<const char> data, F&& block) -> void 
 {
-    std::locale::global(std::locale(""));
-    std::cin.tie(nullptr);
+    std::size_t i {0};
 
-    auto options {parse_options(argc, argv)};
+    for (; i + 64 <= data.size(); i += 64) {
+        block(data.data() + i, std::size_t {64});
+    }
 
-    if (not options) {
-        if (options.error() == ParseOptionsError::help_requested) {
-            help(std::cout, argv[0]);
-            return EXIT_SUCCESS;
-        }
+    if (i < data.size()) {
+        char tail[64] {};
 
-        if (options.error() == ParseOptionsError::unknown_option) {
-            usage_err(std::cerr, argv[0]);
-            return EXIT_FAILURE;
-        }
+        std::memcpy(tail, data.data() + i, data.size() - i);
+        block(static_cast<const char*>(tail), data.size() - i);
     }
+}
 
-    if (not(options->count_lines or options->count_words or
-            options->count_bytes or options->count_max_line_length)) {
-        options->count_lines = options->count_words = options->count_bytes =
-            true;
+[[nodiscard]] static auto load64(const char* p) -> std::uint64_t 
+{
+    std::uint64_t v {};
+
+    std::memcpy(&v, p, sizeof v);
+    return v;
+}
+
+[[nodiscard]] static auto fmix64(std::uint64_t h) -> std::uint64_t 
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* A fast non-cryptographic 64-bit hash, in the style of MurmurHash3: each
+ * 8-byte word is mixed into the state, and the result is finalized with the
+ * MurmurHash3 64-bit finalizer so that all bits are well distributed. */
+[[nodiscard]] static auto hash_bytes(std::string_view s) -> std::uint64_t 
+{
+    constexpr std::uint64_t k1 {0x87c37b91114253d5ULL};
+    constexpr std::uint64_t k2 {0x4cf5ad432745937fULL};
+    std::uint64_t h {0x9e3779b97f4a7c15ULL ^ (s.size() * k2)};
+    std::size_t i {0};
+
+    for (; i + 8 <= s.size(); i += 8) {
+        h ^= std::rotl(load64(s.data() + i) * k1, 31) * k2;
+        h = std::rotl(h, 27) * 5 + 0x52dce729;
     }
 
-    if (optind == argc) {
-        std::ios_base::sync_with_stdio(false);
-        return wc_file(options.value(), std::cin, "stdin");
+    if (i < s.size()) {
+        char tail[8] {};
+
+        std::memcpy(tail, s.data() + i, s.size() - i);
+        h ^= std::rotl(load64(tail) * k1, 31) * k2;
     }
+    return fmix64(h);
+}
 
-    auto total_stats {FileStatistics {}};
-    int nfiles {optind < argc ? argc - optind : 1};
+/* Bit i of the result is the XOR of bits 0 to i of x. Applied to a mask of
+ * quote characters, this sets every bit from an opening quote up to, but not
+ * including, the matching closing quote. */
+[[nodiscard]] static auto prefix_xor(std::uint64_t x) -> std::uint64_t 
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
 
-    for (int i {optind}; i < argc; ++i) {
-        auto const path {std::string_view {argv[i]}};
-        
-        if (fs::is_directory(path)) {
-            std::cerr << std::format("wc: {}: Is a directory.\n", argv[i]);
-            write_counts(std::cout, options.value(), FileStatistics {0},
-                     argv[i]);
-        } else if (fs::is_regular_file(path)) {
-            auto file {std::ifstream {argv[i], std::ios::binary}};
+#if defined(__x86_64__)
+/* prefix_xor() as one carry-less multiplication by all-ones, which is exactly
+ * a prefix XOR. The scanners take it as a template argument, so that the
+ * call is direct. */
+[[gnu::target("pclmul")]] [[nodiscard]] static auto prefix_xor_clmul(
+    std::uint64_t x) -> std::uint64_t 
+{
+    const auto product {_mm_clmulepi64_si128(
+        _mm_set_epi64x(0, static_cast<long long>(x)), _mm_set1_epi8(-1), 0)};
+    return static_cast<std::uint64_t>(_mm_cvtsi128_si64(product));
+}
 
-            if (wc_file(options.value(), file, argv[i], nfiles,
-                        total_stats) == EXIT_FAILURE) {
-                return EXIT_FAILURE;
-            }
-        } else if (path == "-") {
-            if (wc_file(options.value(), std::cin, argv[i], nfiles,
-                        total_stats) == EXIT_FAILURE) {
-                return EXIT_FAILURE;
-            }
-        } else {
-            std::cerr << std::format("wc: {}: No such file or directory.\n", 
-                     argv[i]);
-        }
-    }
+/* Whether prefix_xor_clmul() can run, which is checked once per feed rather
+ * than per block. */
+[[nodiscard]] static auto has_clmul() -> bool 
+{
+    static const bool clmul {__builtin_cpu_supports("pclmul") != 0};
+    return clmul;
+}
+#endif
 
-    if (nfiles > 1) {
-        write_counts(std::cout, options.value(), total_stats, "total");
+/* Returns a mask with bits [0, n) set, for n in [0, 64]. */
+[[nodiscard]] static auto low_bits(std::size_t n) -> std::uint64_t 
+{
+    return n >= 64 ? ~std::uint64_t {0} : (std::uint64_t {1} << n) - 1;
+}
+
+/* The part of a CSV record seen so far. */
+struct CsvSegment {
+    std::uintmax_t delimiters {0};
+    std::uintmax_t length {0};
+    bool only_cr {false}; /* The segment is a single '\r'. */
+};
+
+[[nodiscard]] static auto join(const CsvSegment& a, const CsvSegment& b)
+    -> CsvSegment 
+{
+    const auto length {a.length + b.length};
+
+    return CsvSegment {a.delimiters + b.delimiters, length,
+                       length == 1 and (a.length == 1 ? a.only_cr : b.only_cr)};
+}
+
+struct CsvScan {
+    bool in_quotes {false};
+
+    /* A chunk of a file split for parallel counting does not start at a
+     * record boundary: the bytes up to its first record terminator complete
+     * a record of the preceding chunk, so they are set aside in head until
+     * the chunks are merged. */
+    bool in_head {false};
+    CsvSegment head {};
+
+    CsvSegment open {};
+    std::uintmax_t records {0};
+    std::uintmax_t min_fields {UINTMAX_MAX};
+    std::uintmax_t max_fields {0};
+};
+
+/* Counting a chunk of a file must not depend on the state at the end of the
+ * previous chunk, so a chunk is scanned under both possible states: outside
+ * (scans[0]) and inside (scans[1]) a quoted field. Both share the quote mask
+ * computed for each block; only the merge decides which one was right. */
+struct CsvState {
+    std::array<CsvScan, 2> scans {};
+    bool chunk {false};
+};
+
+static auto end_record(CsvScan& scan) -> void 
+{
+    if (scan.in_head) {
+        scan.head = scan.open;
+        scan.in_head = false;
+    } else if (scan.open.length > 1 or 
+               scan.open.length == 1 and not scan.open.only_cr) {
+        const auto fields {scan.open.delimiters + 1};
+
+        ++scan.records;
+        scan.min_fields = std::min(fields, scan.min_fields);
+        scan.max_fields = std::max(fields, scan.max_fields);
+    }
+    scan.open = CsvSegment {};
+}
+
+static auto csv_scan(CsvScan& scan,
+                     const char* p,
+                     std::size_t n,
+                     std::uint64_t quotes,
+                     std::uint64_t quoted,
+                     std::uint64_t delimiters,
+                     std::uint64_t newlines) -> void 
+{
+    const auto inside {scan.in_quotes ? ~quoted : quoted};
+    const auto separators {delimiters & ~inside};
+    auto terminators {newlines & ~inside};
+    std::size_t start {0};
+
+    const auto segment {[&](std::size_t end) {
+        return CsvSegment {
+            static_cast<std::uintmax_t>(
+                std::popcount(separators & low_bits(end) & ~low_bits(start))),
+            end - start, end - start == 1 and p[start] == '\r'};
+    }};
+
+    while (terminators != 0) {
+        const auto pos {static_cast<std::size_t>(std::countr_zero(terminators))};
+
+        scan.open = join(scan.open, segment(pos));
+        end_record(scan);
+        start = pos + 1;
+        terminators &= terminators - 1;
+    }
+
+    scan.open = join(scan.open, segment(n));
+    scan.in_quotes ^= (std::popcount(quotes) & 1) != 0;
+}
+
+/* Scans a block of at most 64 bytes, padded with NULs to 64 bytes. */
+template <std::uint64_t (*prefix)(std::uint64_t)>
+static auto csv_block(CsvState& csv, const char* p, std::size_t n) -> void 
+{
+    const auto quotes {match64(p, '"')};
+    const auto quoted {prefix(quotes)};
+    const auto delimiters {match64(p, ',')};
+    const auto newlines {match64(p, '\n')};
+
+    csv_scan(csv.scans[0], p, n, quotes, quoted, delimiters, newlines);
+
+    if (csv.chunk) {
+        csv_scan(csv.scans[1], p, n, quotes, quoted, delimiters, newlines);
+    }
+}
+
+template <std::uint64_t (*prefix)(std::uint64_t)>
+static auto csv_blocks(CsvState& csv, std::span<const char> data) -> void 
+{
+    for_each_block(data, [&csv](const char* p, std::size_t n) {
+        csv_block<prefix>(csv, p, n);
+    });
+}
+
+static auto csv_feed(CsvState& csv, std::span<const char> data) -> void 
+{
+#if defined(__x86_64__)
+    if (has_clmul()) {
+        csv_blocks<prefix_xor_clmul>(csv, data);
+        return;
+    }
+#endif
+    csv_blocks<prefix_xor>(csv, data);
+}
+
+/* Merges the scan of a chunk into the scan of all the bytes preceding it. */
+static auto csv_merge(CsvScan& scan, const CsvState& chunk) -> void 
+{
+    const auto& next {chunk.scans[scan.in_quotes ? 1 : 0]};
+
+    if (next.in_head) {
+        scan.open = join(scan.open, next.open);
+    } else {
+        scan.open = join(scan.open, next.head);
+        end_record(scan);
+        scan.records += next.records;
+        scan.min_fields = std::min(next.min_fields, scan.min_fields);
+        scan.max_fields = std::max(next.max_fields, scan.max_fields);
+        scan.open = next.open;
+    }
+    scan.in_quotes = next.in_quotes;
+}
+
+/* JSON Lines validation. Each line is checked without building its values:
+ * escaped bytes, string interiors and structural characters are found as
+ * bitmasks of 64-byte blocks, and only the brackets and braces outside strings
+ * are visited one by one to check their nesting. A newline always ends a
+ * record, as JSON strings cannot contain one. */
+struct JsonlState {
+    std::uintmax_t records {0};
+    std::uintmax_t empty {0};
+    std::uintmax_t malformed {0};
+    std::uintmax_t first_malformed {UINTMAX_MAX};
+
+    std::uintmax_t offset {0}; /* Of the next block. */
+    std::uintmax_t line_start {0};
+    std::string nesting {}; /* The unclosed '{' and '[' of the line. */
+    bool content {false};
+    bool bad {false};
+    bool complete {false}; /* The top-level value of the line is closed. */
+    bool in_string {false};
+    bool escape {false}; /* The next block starts with an escaped byte. */
+};
+
+static auto jsonl_end_line(JsonlState& jsonl, std::uintmax_t next_line) -> void 
+{
+    if (jsonl.content) {
+        ++jsonl.records;
+
+        if (jsonl.bad or jsonl.in_string or not jsonl.nesting.empty()) {
+            ++jsonl.malformed;
+            jsonl.first_malformed =
+                std::min(jsonl.line_start, jsonl.first_malformed);
+        }
+    } else {
+        ++jsonl.empty;
+    }
+
+    jsonl.line_start = next_line;
+    jsonl.nesting.clear();
+    jsonl.content = jsonl.bad = jsonl.complete = jsonl.in_string = false;
+}
+
+/* Returns the mask of the bytes that follow an unescaped backslash in a block
+ * of n bytes. carry tells whether the block starts with an escaped byte, and
+ * is set if the next block does. */
+[[nodiscard]] static auto escaped_bytes(std::uint64_t backslashes,
+                                        std::size_t n,
+                                        bool& carry) -> std::uint64_t 
+{
+    std::uint64_t escaped {carry ? std::uint64_t {1} : 0};
+
+    backslashes &= ~escaped;
+    carry = false;
+
+    while (backslashes != 0) {
+        const auto pos {std::countr_zero(backslashes)};
+
+        if (static_cast<std::size_t>(pos) + 1 == n) {
+            carry = true;
+            break;
+        }
+
+        escaped |= std::uint64_t {2} << pos;
+        backslashes &= ~(std::uint64_t {3} << pos);
+    }
+    return escaped;
+}
+
+template <std::uint64_t (*prefix)(std::uint64_t)>
+static auto jsonl_block(JsonlState& jsonl, const char* p, std::size_t n) -> void 
+{
+    const auto valid {low_bits(n)};
+    const auto newlines {match64(p, '\n')};
+    const auto backslashes {match64(p, '\\') & valid};
+    const auto escaped {escaped_bytes(backslashes, n, jsonl.escape)};
+    const auto quotes {match64(p, '"') & ~escaped};
+    const auto blanks {match64(p, ' ') | match64(p, '\t') | match64(p, '\r') |
+                       newlines};
+    const auto controls {below64(p, 0x20) & ~newlines};
+    const auto structurals {match64(p, '{') | match64(p, '}') |
+                            match64(p, '[') | match64(p, ']')};
+    auto ends {newlines & valid};
+    std::size_t start {0};
+
+    while (true) {
+        const auto end {ends != 0
+                            ? static_cast<std::size_t>(std::countr_zero(ends))
+                            : n};
+        const auto line {low_bits(end) & ~low_bits(start)};
+        const auto line_quotes {quotes & line};
+        const auto inside {
+            (prefix(line_quotes) ^ (jsonl.in_string ? ~std::uint64_t {0} : 0)) &
+            line};
+
+        jsonl.in_string ^= (std::popcount(line_quotes) & 1) != 0;
+        jsonl.content = jsonl.content or (~blanks & line) != 0;
+
+        if (not jsonl.bad) {
+            const auto escapes_inside {escaped & inside};
+
+            jsonl.bad = (controls & inside) != 0 or
+                        (backslashes & ~escaped & ~inside & line) != 0;
+
+            if (escapes_inside != 0) {
+                const auto allowed {
+                    match64(p, '"') | match64(p, '\\') | match64(p, '/') |
+                    match64(p, 'b') | match64(p, 'f') | match64(p, 'n') |
+                    match64(p, 'r') | match64(p, 't') | match64(p, 'u')};
+
+                jsonl.bad = jsonl.bad or (escapes_inside & ~allowed) != 0;
+            }
+
+            for (auto s {structurals & ~inside & line}; s != 0 and not jsonl.bad;
+                 s &= s - 1) {
+                const auto c {p[std::countr_zero(s)]};
+
+                if (c == '{' or c == '[') {
+                    jsonl.bad = jsonl.complete;
+                    jsonl.nesting.push_back(c);
+                } else if (jsonl.nesting.empty() or
+                           jsonl.nesting.back() != (c == '}' ? '{' : '[')) {
+                    jsonl.bad = true;
+                } else {
+                    jsonl.nesting.pop_back();
+                    jsonl.complete = jsonl.nesting.empty();
+                }
+            }
+        }
+
+        if (ends == 0) {
+            break;
+        }
+
+        jsonl_end_line(jsonl, jsonl.offset + end + 1);
+        start = end + 1;
+        ends &= ends - 1;
+    }
+    jsonl.offset += n;
+}
+
+template <std::uint64_t (*prefix)(std::uint64_t)>
+static auto jsonl_blocks(JsonlState& jsonl, std::span<const char> data) -> void 
+{
+    for_each_block(data, [&jsonl](const char* p, std::size_t n) {
+        jsonl_block<prefix>(jsonl, p, n);
+    });
+}
+
+static auto jsonl_feed(JsonlState& jsonl, std::span<const char> data) -> void 
+{
+#if defined(__x86_64__)
+    if (has_clmul()) {
+        jsonl_blocks<prefix_xor_clmul>(jsonl, data);
+        return;
+    }
+#endif
+    jsonl_blocks<prefix_xor>(jsonl, data);
+}
+
+/* Merges the state of a chunk into the state of all the bytes preceding it. */
+static auto jsonl_merge(JsonlState& jsonl, const JsonlState& chunk) -> void 
+{
+    const auto base {jsonl.offset};
+
+    jsonl.records += chunk.records;
+    jsonl.empty += chunk.empty;
+    jsonl.malformed += chunk.malformed;
+
+    if (chunk.first_malformed != UINTMAX_MAX) {
+        jsonl.first_malformed =
+            std::min(base + chunk.first_malformed, jsonl.first_malformed);
+    }
+
+    jsonl.offset = base + chunk.offset;
+    jsonl.line_start = base + chunk.line_start;
+    jsonl.nesting = chunk.nesting;
+    jsonl.content = chunk.content;
+    jsonl.bad = chunk.bad;
+    jsonl.complete = chunk.complete;
+    jsonl.in_string = chunk.in_string;
+    jsonl.escape = chunk.escape;
+}
+
+/* Comment and string syntax of the languages known to --sloc. */
+struct Language {
+    std::string_view name;
+    std::string_view files; /* Extensions and file names, space-separated. */
+    std::string_view line_comment;
+    std::string_view block_open;
+    std::string_view block_close;
+    std::string_view quotes;
+    bool multiline_strings;
+};
+
+static constexpr Language languages[] {
+    {"C", ".c .h", "//", "/*", "*/", "\"'", false},
+    {"C++", ".cc .cpp .cxx .c++ .hh .hpp .hxx .h++ .ipp .tpp .inl", 
+     "//", "/*", "*/", "\"'", false},
+    {"C#", ".cs", "//", "/*", "*/", "\"'", false},
+    {"Objective-C", ".m .mm", "//", "/*", "*/", "\"'", false},
+    {"Java", ".java", "//", "/*", "*/", "\"'", false},
+    {"Kotlin", ".kt .kts", "//", "/*", "*/", "\"'", true},
+    {"Scala", ".scala .sc", "//", "/*", "*/", "\"", true},
+    {"Swift", ".swift", "//", "/*", "*/", "\"", true},
+    {"Go", ".go", "//", "/*", "*/", "\"'`", true},
+    {"Rust", ".rs", "//", "/*", "*/", "\"", true},
+    {"Zig", ".zig", "//", "", "", "\"'", false},
+    {"Dart", ".dart", "//", "/*", "*/", "\"'", true},
+    {"JavaScript", ".js .mjs .cjs .jsx", "//", "/*", "*/", "\"'`", true},
+    {"TypeScript", ".ts .mts .cts .tsx", "//", "/*", "*/", "\"'`", true},
+    {"PHP", ".php", "//", "/*", "*/", "\"'", true},
+    {"CSS", ".css .scss .less", "", "/*", "*/", "\"'", false},
+    {"SQL", ".sql", "--", "/*", "*/", "'\"", true},
+    {"Lua", ".lua", "--", "--[[", "]]", "\"'", false},
+    {"Haskell", ".hs", "--", "{-", "-}", "\"", false},
+    {"Python", ".py .pyi .pyw", "#", "", "", "\"'", true},
+    {"Ruby", ".rb .rake Rakefile Gemfile", "#", "", "", "\"'", true},
+    {"Perl", ".pl .pm", "#", "", "", "\"'", true},
+    {"Shell", ".sh .bash .zsh .ksh", "#", "", "", "\"'", true},
+    {"R", ".r .R", "#", "", "", "\"'", true},
+    {"Makefile", ".mk .mak Makefile makefile GNUmakefile", "#", "", "", "", false},
+    {"CMake", ".cmake CMakeLists.txt", "#", "", "", "\"", true},
+    {"YAML", ".yml .yaml", "#", "", "", "\"'", false},
+    {"TOML", ".toml", "#", "", "", "\"'", false},
+    {"Lisp", ".lisp .lsp .el .cl .scm .ss .clj", ";", "#|", "|#", "\"", true},
+    {"Erlang", ".erl .hrl", "%", "", "", "\"", true},
+    {"TeX", ".tex .sty .cls", "%", "", "", "", false},
+    {"HTML", ".html .htm .xhtml", "", "<!--", "-->", "", false},
+    {"XML", ".xml .xsd .xsl .xslt .svg", "", "<!--", "-->", "", false},
+};
+
+constexpr auto nlanguages {std::size(languages)};
+
+/* Returns the index in languages of the language of file, or -1. */
+[[nodiscard]] static auto find_language(std::string_view file) -> int 
+{
+    const auto slash {file.rfind('/')};
+    const auto name {slash == file.npos ? file : file.substr(slash + 1)};
+    const auto dot {name.rfind('.')};
+    const auto extension {dot == name.npos or dot == 0 ? std::string_view {}
+                                                       : name.substr(dot)};
+
+    for (std::size_t i {0}; i < nlanguages; ++i) {
+        for (std::string_view files {languages[i].files}; not files.empty();) {
+            const auto space {files.find(' ')};
+            const auto entry {files.substr(0, space)};
+
+            if (entry == name or entry == extension) {
+                return static_cast<int>(i);
+            }
+            files.remove_prefix(space == files.npos ? files.size() : space + 1);
+        }
+    }
+    return -1;
+}
+
+/* Line classification for --sloc. The bytes that can change the state of the
+ * scanner (newlines, backslashes, string delimiters and the first byte of
+ * comment markers) are found as a bitmask of each 64-byte block; the scanner
+ * then jumps from one of them to the next, and only checks whether the bytes
+ * in between are blank. Buffers are cut at the last newline, so that no
+ * marker spans two calls to the scanner; the incomplete line is kept for the
+ * next buffer. */
+struct SlocState {
+    const Language* language {nullptr};
+    std::string specials {};
+    std::string partial {};
+
+    std::uintmax_t code {0};
+    std::uintmax_t comment {0};
+    std::uintmax_t blank {0};
+
+    std::size_t skip {0}; /* Bytes of the next block already scanned. */
+    char quote {0};       /* The delimiter of the open string, if any. */
+    bool in_block_comment {false};
+    bool in_line_comment {false};
+    bool has_code {false};
+    bool has_comment {false};
+};
+
+static auto sloc_init(SlocState& sloc, const Language& language) -> void 
+{
+    sloc.language = &language;
+
+    for (const auto marker : {language.line_comment, language.block_open,
+                              language.block_close}) {
+        if (not marker.empty()) {
+            sloc.specials.push_back(marker.front());
+        }
+    }
+    sloc.specials += language.quotes;
+    sloc.specials.push_back('\\');
+}
+
+static auto sloc_end_line(SlocState& sloc) -> void 
+{
+    if (sloc.has_code) {
+        ++sloc.code;
+    } else if (sloc.has_comment) {
+        ++sloc.comment;
+    } else {
+        ++sloc.blank;
+    }
+
+    sloc.has_code = sloc.has_comment = sloc.in_line_comment = false;
+
+    if (not sloc.language->multiline_strings) {
+        sloc.quote = 0;
+    }
+}
+
+/* Scans the special byte at p, and returns the number of bytes it takes up. */
+[[nodiscard]] static auto sloc_step(SlocState& sloc, const char* p, const char* end)
+    -> std::size_t 
+{
+    const auto& language {*sloc.language};
+    const auto starts_with {[p, end](std::string_view marker) {
+        return not marker.empty() and 
+               static_cast<std::size_t>(end - p) >= marker.size() and
+               std::memcmp(p, marker.data(), marker.size()) == 0;
+    }};
+
+    if (*p == '\n') {
+        sloc_end_line(sloc);
+        return 1;
+    }
+
+    if (sloc.in_line_comment) {
+        sloc.has_comment = true;
+        return 1;
+    }
+
+    if (sloc.in_block_comment) {
+        sloc.has_comment = true;
+
+        if (starts_with(language.block_close)) {
+            sloc.in_block_comment = false;
+            return language.block_close.size();
+        }
+        return 1;
+    }
+
+    if (sloc.quote != 0) {
+        sloc.has_code = true;
+
+        if (*p == '\\' and end - p > 1 and p[1] != '\n') {
+            return 2;
+        }
+
+        if (*p == sloc.quote) {
+            sloc.quote = 0;
+        }
+        return 1;
+    }
+
+    if (starts_with(language.block_open)) {
+        sloc.has_comment = sloc.in_block_comment = true;
+        return language.block_open.size();
+    }
+
+    if (starts_with(language.line_comment)) {
+        sloc.has_comment = sloc.in_line_comment = true;
+        return language.line_comment.size();
+    }
+
+    sloc.has_code = true;
+
+    if (language.quotes.find(*p) != language.quotes.npos) {
+        sloc.quote = *p;
+    }
+    return 1;
+}
+
+/* Scans the bytes in [begin, end), which end with a newline, unless the input
+ * does not. */
+static auto sloc_scan(SlocState& sloc, const char* begin, const char* end)
+    -> void 
+{
+    /* Marks the line as code or comment if bytes has non-blank bytes. */
+    const auto mark {[&sloc](std::uint64_t bytes) {
+        if (bytes != 0) {
+            (sloc.in_block_comment or sloc.in_line_comment ? sloc.has_comment
+                                                           : sloc.has_code) = true;
+        }
+    }};
+
+    for (const char* block {begin}; block < end; block += 64) {
+        const auto n {std::min<std::size_t>(64, static_cast<std::size_t>(end - block))};
+        char padded[64] {};
+        const char* p {block};
+
+        if (sloc.skip >= n) {
+            sloc.skip -= n;
+            continue;
+        }
+
+        if (n < 64) {
+            std::memcpy(padded, block, n);
+            p = padded;
+        }
+
+        const auto valid {low_bits(n)};
+        const auto blanks {match64(p, ' ') | match64(p, '\t') | match64(p, '\r') |
+                           match64(p, '\n') | match64(p, '\f') | match64(p, '\v')};
+        const auto nonblank {~blanks & valid};
+        auto start {sloc.skip};
+        auto todo {match64(p, '\n')};
+
+        for (const char c : sloc.specials) {
+            todo |= match64(p, c);
+        }
+
+        todo &= valid & ~low_bits(start);
+        sloc.skip = 0;
+
+        while (todo != 0) {
+            const auto pos {static_cast<std::size_t>(std::countr_zero(todo))};
+
+            mark(nonblank & low_bits(pos) & ~low_bits(start));
+            start = pos + sloc_step(sloc, block + pos, end);
+
+            if (start >= n) {
+                sloc.skip = start - n;
+                break;
+            }
+            todo &= ~low_bits(start);
+        }
+
+        if (start < n) {
+            mark(nonblank & ~low_bits(start));
+        }
+    }
+}
+
+static auto sloc_feed(SlocState& sloc, std::span<const char> data) -> void 
+{
+    const auto* const last {static_cast<const char*>(
+        ::memrchr(data.data(), '\n', data.size()))};
+
+    if (not last) {
+        sloc.partial.append(data.data(), data.size());
+        return;
+    }
+
+    const char* begin {data.data()};
+
+    if (not sloc.partial.empty()) {
+        const auto* const first {static_cast<const char*>(
+            std::memchr(begin, '\n', data.size()))};
+
+        sloc.partial.append(begin, first + 1);
+        sloc_scan(sloc, sloc.partial.data(),
+                  sloc.partial.data() + sloc.partial.size());
+        sloc.partial.clear();
+        begin = first + 1;
+    }
+
+    sloc_scan(sloc, begin, last + 1);
+    sloc.partial.assign(last + 1, data.data() + data.size());
+}
+
+static auto sloc_finish(SlocState& sloc) -> void 
+{
+    if (not sloc.partial.empty()) {
+        sloc_scan(sloc, sloc.partial.data(),
+                  sloc.partial.data() + sloc.partial.size());
+        sloc_end_line(sloc);
+    }
+}
+
+/* The memory that --max-memory allows, which buffers and the sets of lines of
+ * --distinct-lines take from, and main() looks at before counting files ahead.
+ * Nothing waits on the budget itself: each user has its own way to give
+ * back-pressure, which cannot wait on main() and deadlock. */
+class MemoryBudget {
+public:
+    /* A limit of 0 is no limit. */
+    explicit MemoryBudget(std::size_t limit)
+        : limit {limit}
+    {
+    }
+
+    /* Takes bytes if they are within the limit. */
+    [[nodiscard]] auto try_take(std::size_t bytes) -> bool
+    {
+        auto taken {used.load()};
+
+        do {
+            if (limit != 0 and (taken > limit or bytes > limit - taken)) {
+                return false;
+            }
+        } while (not used.compare_exchange_weak(taken, taken + bytes));
+        return true;
+    }
+
+    /* Takes bytes even past the limit, for what must go on. */
+    auto take(std::size_t bytes) -> void
+    {
+        used += bytes;
+    }
+
+    auto give_back(std::size_t bytes) -> void
+    {
+        used -= bytes;
+    }
+
+    [[nodiscard]] auto exhausted() const -> bool
+    {
+        return limit != 0 and used.load() >= limit;
+    }
+
+private:
+    std::size_t limit;
+    std::atomic<std::size_t> used {0};
+};
+
+/* A bump allocator: copies live until the arena is cleared or destroyed. */
+class Arena {
+public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena(Arena&&) = default;
+    auto operator=(const Arena&) -> Arena& = delete;
+    auto operator=(Arena&&) -> Arena& = default;
+    ~Arena() = default;
+
+    /* Returns a copy of s, which is never null, even if s is empty. */
+    [[nodiscard]] auto copy(std::string_view s) -> const char*
+    {
+        if (s.size() > left or not next) {
+            const auto size {std::max(s.size(), block_size)};
+
+            blocks.push_back(std::make_unique_for_overwrite<char[]>(size));
+            next = blocks.back().get();
+            left = size;
+        }
+
+        char* const p {next};
+
+        std::memcpy(p, s.data(), s.size());
+        next += s.size();
+        left -= s.size();
+        used += s.size();
+        return p;
+    }
+
+    auto clear() -> void
+    {
+        blocks.clear();
+        next = nullptr;
+        left = used = 0;
+    }
+
+    /* Returns the number of bytes copied to the arena. */
+    [[nodiscard]] auto size() const -> std::size_t
+    {
+        return used;
+    }
+
+private:
+    static constexpr std::size_t block_size {1 << 20};
+
+    std::vector<std::unique_ptr<char[]>> blocks {};
+    char* next {nullptr};
+    std::size_t left {0};
+    std::size_t used {0};
+};
+
+/* An exact set of lines for --distinct-lines: an open-addressing hash table
+ * with linear probing, whose keys are copied into an arena.
+ *
+ * Past memory_limit bytes, or when the budget has no more for it, the table
+ * is spilled: its keys are appended to one of 64 temporary files chosen by 6
+ * bits of their hash, and it is cleared. Equal lines always land in the same
+ * file, so the number of distinct lines is the sum of the distinct lines of
+ * each file, which are counted by a set that takes the next 6 bits of the
+ * hash to spill, should it still be too large. */
+class DistinctLines {
+public:
+    DistinctLines(std::size_t memory_limit, unsigned depth, MemoryBudget& budget)
+        : memory_limit {memory_limit == 0 
+                            ? 0 
+                            : std::max(memory_limit, min_memory_limit)},
+          depth {depth},
+          budget {&budget}
+    {
+    }
+
+    DistinctLines(const DistinctLines&) = delete;
+    auto operator=(const DistinctLines&) -> DistinctLines& = delete;
+
+    ~DistinctLines()
+    {
+        budget->give_back(charged);
+    }
+
+    auto insert(std::uint64_t hash, std::string_view line) -> void
+    {
+        if (used * 4 >= table.size() * 3) {
+            grow();
+        }
+
+        auto i {hash & (table.size() - 1)};
+
+        for (; table[i].key; i = (i + 1) & (table.size() - 1)) {
+            if (table[i].hash == hash and table[i].key_size == line.size() and 
+                std::memcmp(table[i].key, line.data(), line.size()) == 0) {
+                return;
+            }
+        }
+
+        table[i] = Entry {hash, arena.copy(line), line.size()};
+        ++used;
+
+        if (depth < max_depth and used > 1 and
+            ((memory_limit != 0 and footprint() > memory_limit) or
+             not charge(false))) {
+            spill();
+        } else {
+            static_cast<void>(charge(true));
+        }
+    }
+
+    /* Adds the lines of other to the set. */
+    auto merge(DistinctLines& other) -> void
+    {
+        for (const auto& entry : other.table) {
+            if (entry.key) {
+                insert(entry.hash, {entry.key, entry.key_size});
+            }
+        }
+
+        for (auto& partition : other.partitions) {
+            read_partition(partition.get(), *this);
+        }
+        failed = failed or other.failed;
+    }
+
+    [[nodiscard]] auto count() -> std::uintmax_t
+    {
+        if (partitions.empty()) {
+            return used;
+        }
+
+        spill();
+
+        std::uintmax_t distinct {0};
+
+        for (auto& partition : partitions) {
+            auto part {DistinctLines {memory_limit, depth + 1, *budget}};
+
+            read_partition(partition.get(), part);
+            distinct += part.count();
+            failed = failed or part.failed;
+        }
+        return distinct;
+    }
+
+    /* Returns the errno of the first failed operation on a temporary file, or
+     * 0. */
+    [[nodiscard]] auto error() const -> int
+    {
+        return failed ? error_number : 0;
+    }
+
+private:
+    struct Entry {
+        std::uint64_t hash {0};
+        const char* key {nullptr};
+        std::size_t key_size {0};
+    };
+
+    struct FileCloser {
+        auto operator()(std::FILE* file) const -> void
+        {
+            std::fclose(file);
+        }
+    };
+
+    /* Each level of spilling takes 6 bits of the hash, from the top. */
+    static constexpr unsigned max_depth {9};
+    static constexpr std::size_t npartitions {64};
+
+    /* Below this, the fixed costs of the table make spilling pointless. */
+    static constexpr std::size_t min_memory_limit {1 << 20};
+
+    /* The budget is taken from in steps of this many bytes. */
+    static constexpr std::size_t charge_step {1 << 20};
+
+    [[nodiscard]] auto footprint() const -> std::size_t
+    {
+        return arena.size() + table.size() * sizeof(Entry);
+    }
+
+    /* Takes what the set has grown by from the budget, and returns true, or
+     * returns false if the budget is spent, unless force. */
+    [[nodiscard]] auto charge(bool force) -> bool
+    {
+        const auto size {footprint()};
+
+        if (size <= charged) {
+            return true;
+        }
+
+        const auto more {(size - charged + charge_step - 1) / charge_step *
+                         charge_step};
+
+        if (force) {
+            budget->take(more);
+        } else if (not budget->try_take(more)) {
+            return false;
+        }
+
+        charged += more;
+        return true;
+    }
+
+    auto grow() -> void
+    {
+        auto old {std::vector<Entry>(std::max<std::size_t>(table.size() * 2, 1024))};
+
+        old.swap(table);
+
+        for (const auto& entry : old) {
+            if (entry.key) {
+                auto i {entry.hash & (table.size() - 1)};
+
+                while (table[i].key) {
+                    i = (i + 1) & (table.size() - 1);
+                }
+                table[i] = entry;
+            }
+        }
+    }
+
+    auto fail() -> void
+    {
+        if (not failed) {
+            failed = true;
+            error_number = errno;
+        }
+    }
+
+    auto spill() -> void
+    {
+        if (partitions.empty()) {
+            for (std::size_t i {0}; i < npartitions; ++i) {
+                partitions.emplace_back(std::tmpfile());
+
+                if (not partitions.back()) {
+                    fail();
+                    return;
+                }
+            }
+        }
+
+        for (const auto& entry : table) {
+            if (not entry.key) {
+                continue;
+            }
+
+            auto* const file {partitions[(entry.hash >> (58 - 6 * depth)) & 63].get()};
+            const std::uint64_t header[2] {entry.hash, entry.key_size};
+
+            if (std::fwrite(header, sizeof header, 1, file) != 1 or 
+                std::fwrite(entry.key, 1, entry.key_size, file) != entry.key_size) {
+                fail();
+            }
+        }
+
+        table.clear();
+        table.shrink_to_fit();
+        arena.clear();
+        used = 0;
+        budget->give_back(charged);
+        charged = 0;
+    }
+
+    auto read_partition(std::FILE* file, DistinctLines& set) -> void
+    {
+        auto key {std::string {}};
+        std::uint64_t header[2] {};
+
+        if (std::fflush(file) != 0 or std::fseek(file, 0, SEEK_SET) != 0) {
+            fail();
+            return;
+        }
+
+        while (std::fread(header, sizeof header, 1, file) == 1) {
+            key.resize(header[1]);
+
+            if (std::fread(key.data(), 1, key.size(), file) != key.size()) {
+                fail();
+                break;
+            }
+            set.insert(header[0], key);
+        }
+
+        if (std::ferror(file) or std::fseek(file, 0, SEEK_END) != 0) {
+            fail();
+        }
+    }
+
+    std::vector<Entry> table {};
+    std::size_t used {0};
+    Arena arena {};
+    std::size_t memory_limit;
+    unsigned depth;
+    MemoryBudget* budget;
+    std::size_t charged {0}; /* The bytes taken from the budget. */
+    std::vector<std::unique_ptr<std::FILE, FileCloser>> partitions {};
+    bool failed {false};
+    int error_number {0};
+};
+
+/* Splits buffers into lines, without their newline. The line that runs past
+ * the end of a buffer is kept in partial until its end is found. */
+struct LineScanner {
+    std::string partial {};
+    bool open {false}; /* Is partial a line, even if empty? */
+};
+
+template <typename F>
+static auto scan_lines(LineScanner& scanner, 
+                       std::span<const char> data, 
+                       F&& on_line) -> void 
+{
+    const char* p {data.data()};
+    const char* const end {p + data.size()};
+
+    while (p < end) {
+        const auto* const nl {static_cast<const char*>(
+            std::memchr(p, '\n', static_cast<std::size_t>(end - p)))};
+
+        if (not nl) {
+            scanner.partial.append(p, end);
+            scanner.open = true;
+            break;
+        }
+
+        auto line {std::string_view {p, nl}};
+
+        if (scanner.open) {
+            scanner.partial.append(line);
+            line = scanner.partial;
+        }
+
+        on_line(line);
+        scanner.partial.clear();
+        scanner.open = false;
+        p = nl + 1;
+    }
+}
+
+template <typename F>
+static auto finish_lines(LineScanner& scanner, F&& on_line) -> void 
+{
+    if (scanner.open) {
+        on_line(std::string_view {scanner.partial});
+        scanner.partial.clear();
+        scanner.open = false;
+    }
+}
+
+/* Returns the mask of the bytes among the n <= 64 bytes at p that are white
+ * space as per isspace(), the rule feed() uses to delimit words. */
+[[nodiscard]] static auto space_mask(const char* p, std::size_t n)
+    -> std::uint64_t 
+{
+    /* Built on first use, once main() has set the locale. */
+    static const auto table {[] {
+        auto spaces {std::array<bool, 256> {}};
+
+        for (std::size_t c {0}; c < spaces.size(); ++c) {
+            spaces[c] = std::isspace(static_cast<int>(c)) != 0;
+        }
+        return spaces;
+    }()};
+    static const bool ascii_only {[] {
+        for (std::size_t c {0}; c < table.size(); ++c) {
+            if (table[c] != (c == ' ' or (c >= '\t' and c <= '\r'))) {
+                return false;
+            }
+        }
+        return true;
+    }()};
+
+    if (ascii_only) {
+        char padded[64] {};
+
+        if (n < 64) {
+            std::memcpy(padded, p, n);
+            p = padded;
+        }
+        return (match64(p, ' ') | match64(p, '\t') | match64(p, '\n') |
+                match64(p, '\v') | match64(p, '\f') | match64(p, '\r')) &
+               low_bits(n);
+    }
+
+    std::uint64_t mask {0};
+
+    for (std::size_t i {0}; i < n; ++i) {
+        mask |= std::uint64_t {table[static_cast<unsigned char>(p[i])]} << i;
+    }
+    return mask;
+}
+
+/* Splits buffers into words, by the rule of feed(): a word is a maximal run
+ * of bytes that are not white space. Word boundaries are found as the edges
+ * of the space mask of each 64-byte block. The word that runs past the end of
+ * a buffer is kept in partial until its end is found. */
+struct WordScanner {
+    std::string partial {};
+    bool in_word {false};
+};
+
+template <typename F>
+static auto scan_words(WordScanner& scanner, 
+                       std::span<const char> data, 
+                       F&& on_word) -> void 
+{
+    const char* const base {data.data()};
+    std::size_t start {0};
+    bool carried {scanner.in_word};
+    bool in_word {scanner.in_word};
+
+    for (std::size_t i {0}; i < data.size(); i += 64) {
+        const auto n {std::min<std::size_t>(64, data.size() - i)};
+        const auto words {~space_mask(base + i, n) & low_bits(n)};
+        const auto before {(words << 1) | std::uint64_t {in_word}};
+        const auto starts {words & ~before};
+        const auto ends {~words & low_bits(n) & before};
+
+        for (auto edges {starts | ends}; edges != 0; edges &= edges - 1) {
+            const auto pos {i + static_cast<std::size_t>(std::countr_zero(edges))};
+
+            if (starts & (edges & -edges)) {
+                start = pos;
+            } else if (carried) {
+                scanner.partial.append(base + start, base + pos);
+                on_word(std::string_view {scanner.partial});
+                scanner.partial.clear();
+                carried = false;
+            } else {
+                on_word(std::string_view {base + start, pos - start});
+            }
+        }
+        in_word = (words >> (n - 1) & 1) != 0;
+    }
+
+    if (in_word) {
+        scanner.partial.append(base + start, base + data.size());
+    }
+    scanner.in_word = in_word;
+}
+
+template <typename F>
+static auto finish_words(WordScanner& scanner, F&& on_word) -> void 
+{
+    if (scanner.in_word) {
+        on_word(std::string_view {scanner.partial});
+        scanner.partial.clear();
+        scanner.in_word = false;
+    }
+}
+
+/* The lines seen by --distinct-lines. */
+struct DistinctState {
+    std::shared_ptr<DistinctLines> lines {};
+    LineScanner scanner {};
+};
+
+static auto distinct_feed(DistinctState& distinct, std::span<const char> data)
+    -> void 
+{
+    scan_lines(distinct.scanner, data, [&distinct](std::string_view line) {
+        distinct.lines->insert(hash_bytes(line), line);
+    });
+}
+
+static auto distinct_finish(DistinctState& distinct) -> void 
+{
+    finish_lines(distinct.scanner, [&distinct](std::string_view line) {
+        distinct.lines->insert(hash_bytes(line), line);
+    });
+}
+
+/* A HyperLogLog sketch: the 2^precision registers each hold the largest
+ * position of the first set bit seen in the hashes whose top precision bits
+ * select it. Sketches of the same precision merge by taking the largest of
+ * each pair of registers, so that chunks, files and saved sketches combine
+ * into exactly the sketch of their union. The standard error of the estimate
+ * is about 1.04 / sqrt(2^precision). */
+class HyperLogLog {
+public:
+    static constexpr unsigned min_precision {4};
+    static constexpr unsigned max_precision {18};
+
+    explicit HyperLogLog(unsigned precision)
+        : precision {precision},
+          registers(std::size_t {1} << precision)
+    {
+    }
+
+    auto add(std::uint64_t hash) -> void
+    {
+        const auto index {hash >> (64 - precision)};
+        const auto rank {static_cast<std::uint8_t>(
+            std::countl_zero((hash << precision) | 
+                             (std::uint64_t {1} << (precision - 1))) + 1)};
+
+        registers[index] = std::max(rank, registers[index]);
+    }
+
+    /* Returns false if the sketches have different precisions. */
+    [[nodiscard]] auto merge(const HyperLogLog& other) -> bool
+    {
+        if (other.precision != precision) {
+            return false;
+        }
+
+        for (std::size_t i {0}; i < registers.size(); ++i) {
+            registers[i] = std::max(other.registers[i], registers[i]);
+        }
+        return true;
+    }
+
+    [[nodiscard]] auto estimate() const -> std::uintmax_t
+    {
+        const auto m {static_cast<double>(registers.size())};
+        const double alpha {precision == 4   ? 0.673
+                            : precision == 5 ? 0.697
+                            : precision == 6 ? 0.709
+                                             : 0.7213 / (1.0 + 1.079 / m)};
+        double sum {0.0};
+        std::size_t zeros {0};
+
+        for (const auto r : registers) {
+            sum += std::ldexp(1.0, -r);
+            zeros += r == 0;
+        }
+
+        auto estimate {alpha * m * m / sum};
+
+        /* Small cardinalities are better estimated by linear counting. */
+        if (estimate <= 2.5 * m and zeros != 0) {
+            estimate = m * std::log(m / static_cast<double>(zeros));
+        }
+        return static_cast<std::uintmax_t>(std::llround(estimate));
+    }
+
+    /* A sketch file holds the magic string "WCHLL", a format version, the
+     * precision, and the registers, one byte each. */
+    [[nodiscard]] auto save(const char* file) const -> bool
+    {
+        auto os {std::ofstream {file, std::ios::binary}};
+        const char header[] {'W', 'C', 'H', 'L', 'L', 1, 
+                             static_cast<char>(precision)};
+
+        os.write(header, sizeof header);
+        os.write(reinterpret_cast<const char*>(registers.data()),
+                 static_cast<std::streamsize>(registers.size()));
+        os.close();
+        return not os.fail();
+    }
+
+    [[nodiscard]] static auto load(const char* file)
+        -> std::expected<HyperLogLog, std::string>
+    {
+        auto is {std::ifstream {file, std::ios::binary}};
+        char header[7] {};
+
+        if (not is.read(header, sizeof header)) {
+            return std::unexpected {is.bad() or not is.is_open()
+                ? std::error_code {errno, std::generic_category()}.message()
+                : std::string {"not a sketch file"}};
+        }
+
+        const auto precision {static_cast<unsigned>(header[6])};
+
+        if (std::memcmp(header, "WCHLL\1", 6) != 0 or 
+            precision < min_precision or precision > max_precision) {
+            return std::unexpected {std::string {"not a sketch file"}};
+        }
+
+        auto sketch {HyperLogLog {precision}};
+
+        if (not is.read(reinterpret_cast<char*>(sketch.registers.data()),
+                        static_cast<std::streamsize>(sketch.registers.size()))) {
+            return std::unexpected {std::string {"truncated sketch file"}};
+        }
+        return sketch;
+    }
+
+private:
+    unsigned precision;
+    std::vector<std::uint8_t> registers;
+};
+
+/* Words and their number of occurrences: an open-addressing hash table with
+ * linear probing, whose keys are copied into an arena. */
+class WordTable {
+public:
+    struct Entry {
+        std::uint64_t hash {0};
+        const char* key {nullptr};
+        std::size_t key_size {0};
+        std::uintmax_t count {0};
+
+        [[nodiscard]] auto word() const -> std::string_view
+        {
+            return {key, key_size};
+        }
+    };
+
+    /* Returns the count of word, which is added with a count of 0 if it is not
+     * in the table. */
+    auto find(std::uint64_t hash, std::string_view word) -> std::uintmax_t&
+    {
+        if (used * 4 >= table.size() * 3) {
+            grow();
+        }
+
+        auto i {hash & (table.size() - 1)};
+
+        for (; table[i].key; i = (i + 1) & (table.size() - 1)) {
+            if (table[i].hash == hash and table[i].key_size == word.size() and 
+                std::memcmp(table[i].key, word.data(), word.size()) == 0) {
+                return table[i].count;
+            }
+        }
+
+        table[i] = Entry {hash, arena.copy(word), word.size(), 0};
+        ++used;
+        return table[i].count;
+    }
+
+    /* Returns the count of word, or null if it is not in the table. */
+    [[nodiscard]] auto lookup(std::uint64_t hash, std::string_view word) const
+        -> const std::uintmax_t*
+    {
+        if (table.empty()) {
+            return nullptr;
+        }
+
+        for (auto i {hash & (table.size() - 1)}; table[i].key;
+             i = (i + 1) & (table.size() - 1)) {
+            if (table[i].hash == hash and table[i].key_size == word.size() and
+                std::memcmp(table[i].key, word.data(), word.size()) == 0) {
+                return &table[i].count;
+            }
+        }
+        return nullptr;
+    }
+
+    [[nodiscard]] auto size() const -> std::size_t
+    {
+        return used;
+    }
+
+    [[nodiscard]] auto entries() const -> std::vector<Entry>
+    {
+        auto entries {std::vector<Entry> {}};
+
+        entries.reserve(used);
+        std::ranges::copy_if(table, std::back_inserter(entries),
+                             [](const Entry& entry) { return entry.key; });
+        return entries;
+    }
+
+    /* Returns the k entries with the highest counts, highest first, and in
+     * byte order for equal counts. */
+    [[nodiscard]] auto top(std::size_t k) const -> std::vector<Entry>
+    {
+        auto top {entries()};
+        const auto n {std::min(k, top.size())};
+        const auto higher {[](const Entry& a, const Entry& b) {
+            return a.count != b.count ? a.count > b.count : a.word() < b.word();
+        }};
+
+        std::ranges::partial_sort(top, top.begin() + static_cast<std::ptrdiff_t>(n),
+                                  higher);
+        top.resize(n);
+        return top;
+    }
+
+private:
+    auto grow() -> void
+    {
+        auto old {std::vector<Entry>(std::max<std::size_t>(table.size() * 2, 1024))};
+
+        old.swap(table);
+
+        for (const auto& entry : old) {
+            if (entry.key) {
+                auto i {entry.hash & (table.size() - 1)};
+
+                while (table[i].key) {
+                    i = (i + 1) & (table.size() - 1);
+                }
+                table[i] = entry;
+            }
+        }
+    }
+
+    std::vector<Entry> table {};
+    std::size_t used {0};
+    Arena arena {};
+};
+
+/* Word frequencies for --top-words. Exact counts are kept in a WordTable.
+ * With a sketch width, occurrences are counted in a count-min sketch instead,
+ * and the table only keeps candidates for the top words with their estimated
+ * count: when it holds twice the number of candidates, it is pruned to the
+ * most frequent ones. A pruned word that comes back gets its estimate from
+ * the sketch, which never underestimates. Sketches merge by adding their
+ * counters, but the chunks of an input count in the sketch of the input, with
+ * atomic additions, so that splitting it takes no more memory. Sketches are
+ * taken from the memory budget. */
+class WordFrequencies {
+public:
+    WordFrequencies(std::size_t k, std::size_t sketch_width, MemoryBudget& budget)
+        : WordFrequencies {std::max<std::size_t>(k * 8, 1024), sketch_width,
+                           sketch_width == 0
+                               ? nullptr
+                               : std::make_shared<Sketch>(
+                                     sketch_width * sketch_depth, budget)}
+    {
+    }
+
+    /* Returns frequencies that count in the same sketch as these, for a chunk
+     * of their input, to be merged into them. */
+    [[nodiscard]] auto share() const -> std::shared_ptr<WordFrequencies>
+    {
+        return std::shared_ptr<WordFrequencies> {
+            new WordFrequencies {candidates, width, sketch}};
+    }
+
+    auto add(std::uint64_t hash, std::string_view word, std::uintmax_t count) 
+        -> void
+    {
+        if (width == 0) {
+            table.find(hash, word) += count;
+            return;
+        }
+
+        auto estimate {UINTMAX_MAX};
+
+        for (std::size_t row {0}; row < sketch_depth; ++row) {
+            auto& counter {
+                sketch->counters[row * width + sketch_index(hash, row)]};
+
+            estimate = std::min(
+                counter.fetch_add(count, std::memory_order_relaxed) + count,
+                estimate);
+        }
+
+        table.find(hash, word) = estimate;
+
+        if (table.size() >= 2 * candidates) {
+            prune();
+        }
+    }
+
+    auto merge(const WordFrequencies& other) -> void
+    {
+        if (width == 0) {
+            for (const auto& entry : other.table.entries()) {
+                add(entry.hash, entry.word(), entry.count);
+            }
+            return;
+        }
+
+        if (other.sketch != sketch) {
+            for (std::size_t i {0}; i < sketch->counters.size(); ++i) {
+                sketch->counters[i].fetch_add(
+                    other.sketch->counters[i].load(std::memory_order_relaxed),
+                    std::memory_order_relaxed);
+            }
+        }
+
+        for (const auto& entry : other.table.entries()) {
+            table.find(entry.hash, entry.word()) = estimate(entry.hash);
+
+            if (table.size() >= 2 * candidates) {
+                prune();
+            }
+        }
+
+        /* Candidates of this table also occur in the other one. */
+        for (const auto& entry : table.entries()) {
+            table.find(entry.hash, entry.word()) = estimate(entry.hash);
+        }
+    }
+
+    [[nodiscard]] auto top(std::size_t k) const -> std::vector<WordTable::Entry>
+    {
+        return table.top(k);
+    }
+
+private:
+    static constexpr std::size_t sketch_depth {4};
+
+    /* The counters of a count-min sketch, in rows of width. */
+    struct Sketch {
+        Sketch(std::size_t size, MemoryBudget& budget)
+            : counters(size),
+              budget {&budget}
+        {
+            budget.take(bytes());
+        }
+
+        Sketch(const Sketch&) = delete;
+        auto operator=(const Sketch&) -> Sketch& = delete;
+
+        ~Sketch()
+        {
+            budget->give_back(bytes());
+        }
+
+        [[nodiscard]] auto bytes() const -> std::size_t
+        {
+            return counters.size() * sizeof counters[0];
+        }
+
+        std::vector<std::atomic<std::uintmax_t>> counters;
+        MemoryBudget* budget;
+    };
+
+    WordFrequencies(std::size_t candidates,
+                    std::size_t width,
+                    std::shared_ptr<Sketch> sketch)
+        : candidates {candidates},
+          width {width},
+          sketch {std::move(sketch)}
+    {
+    }
+
+    /* Each row takes a different 16-bit rotation of the hash. */
+    [[nodiscard]] auto sketch_index(std::uint64_t hash, std::size_t row) const 
+        -> std::size_t
+    {
+        return fmix64(std::rotl(hash, static_cast<int>(16 * row))) & (width - 1);
+    }
+
+    [[nodiscard]] auto estimate(std::uint64_t hash) const -> std::uintmax_t
+    {
+        auto estimate {UINTMAX_MAX};
+
+        for (std::size_t row {0}; row < sketch_depth; ++row) {
+            estimate = std::min(
+                sketch->counters[row * width + sketch_index(hash, row)].load(
+                    std::memory_order_relaxed),
+                estimate);
+        }
+        return estimate;
+    }
+
+    auto prune() -> void
+    {
+        auto pruned {WordTable {}};
+
+        for (const auto& entry : table.top(candidates)) {
+            pruned.find(entry.hash, entry.word()) = entry.count;
+        }
+        table = std::move(pruned);
+    }
+
+    WordTable table {};
+    std::size_t candidates;
+    std::size_t width;
+    std::shared_ptr<Sketch> sketch; /* Null without a sketch width. */
+};
+
+/* The state of --top-words. */
+struct TopWordsState {
+    std::shared_ptr<WordFrequencies> frequencies {};
+    WordScanner scanner {};
+};
+
+static auto top_words_feed(TopWordsState& top_words, std::span<const char> data)
+    -> void 
+{
+    scan_words(top_words.scanner, data, [&top_words](std::string_view word) {
+        top_words.frequencies->add(hash_bytes(word), word, 1);
+    });
+}
+
+static auto top_words_finish(TopWordsState& top_words) -> void 
+{
+    finish_words(top_words.scanner, [&top_words](std::string_view word) {
+        top_words.frequencies->add(hash_bytes(word), word, 1);
+    });
+}
+
+/* The classes of bytes that delimit pre-tokens for --tokens. All bytes that
+ * are not ASCII are taken as letters, as most of them are part of letters in
+ * UTF-8 text. */
+enum class ByteClass {
+    space,
+    letter,
+    digit,
+    other,
+    none
+};
+
+/* Splits buffers into pre-tokens, by the rules of the regular expression of
+ * GPT-2:
+ *
+ *     's|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+
+ *
+ * Runs of bytes of the same class are found as the edges of the class masks
+ * of each 64-byte block, the white space mask being the one of the word
+ * scanner, and each run is then a pre-token but for three rules: the last
+ * white space before a run that is not white space is its own pre-token, or,
+ * if it is a space, the prefix of that run; and a lone apostrophe before
+ * letters that start with a contraction suffix takes that suffix.
+ *
+ * A scanner of a chunk that starts after a newline cannot know the white space
+ * before it, nor so which pre-token its first run starts: until the end of its
+ * first run that is not white space or a lone apostrophe, it keeps the bytes
+ * in head, to be scanned again by the scanner of the preceding bytes. */
+struct TokenScanner {
+    std::string partial {};
+    ByteClass run {ByteClass::none};
+    bool space_prefix {false};
+    bool apostrophe {false};
+    bool in_head {false};
+    std::string head {};
+};
+
+/* Returns the length of the contraction suffix that letters start with, or 0
+ * if they do not start with one. */
+[[nodiscard]] static auto contraction_suffix(std::string_view letters)
+    -> std::size_t 
+{
+    for (const std::string_view suffix : {"s", "t", "m", "d", "re", "ve", "ll"}) {
+        if (letters.starts_with(suffix)) {
+            return suffix.size();
+        }
+    }
+    return 0;
+}
+
+/* Ends the current run of the scanner, whose bytes are run. A run of white
+ * space is known to be followed by a run that is not. on_token(prefix, body)
+ * is called for each pre-token, which is the concatenation of both. */
+template <typename F>
+static auto end_run(TokenScanner& scanner, std::string_view run, F&& on_token)
+    -> void 
+{
+    using namespace std::string_view_literals;
+
+    if (scanner.in_head) {
+        scanner.head.append(run);
+        scanner.in_head = scanner.run == ByteClass::space or run == "'"sv;
+        return;
+    }
+
+    if (scanner.run == ByteClass::space) {
+        if (scanner.apostrophe) {
+            on_token(""sv, "'"sv);
+            scanner.apostrophe = false;
+        }
+
+        if (run.size() > 1) {
+            on_token(""sv, run.substr(0, run.size() - 1));
+        }
+
+        if (run.back() == ' ') {
+            scanner.space_prefix = true;
+        } else {
+            on_token(""sv, run.substr(run.size() - 1));
+        }
+        return;
+    }
+
+    if (scanner.apostrophe) {
+        const auto suffix {
+            scanner.run == ByteClass::letter ? contraction_suffix(run) : 0};
+
+        scanner.apostrophe = false;
+
+        if (suffix != 0) {
+            on_token("'"sv, run.substr(0, suffix));
+            run.remove_prefix(suffix);
+
+            if (run.empty()) {
+                return;
+            }
+        } else {
+            on_token(""sv, "'"sv);
+        }
+    } else if (run == "'"sv and not scanner.space_prefix) {
+        scanner.apostrophe = true;
+        return;
+    }
+
+    on_token(scanner.space_prefix ? " "sv : ""sv, run);
+    scanner.space_prefix = false;
+}
+
+template <typename F>
+static auto scan_tokens(TokenScanner& scanner,
+                        std::span<const char> data,
+                        F&& on_token) -> void 
+{
+    const char* const base {data.data()};
+    std::size_t start {0};
+    bool carried {scanner.run != ByteClass::none};
+
+    for (std::size_t i {0}; i < data.size(); i += 64) {
+        const auto n {std::min<std::size_t>(64, data.size() - i)};
+        const char* p {base + i};
+        char padded[64] {};
+
+        if (n < 64) {
+            std::memcpy(padded, p, n);
+            p = padded;
+        }
+
+        const auto valid {low_bits(n)};
+        const auto spaces {space_mask(p, n)};
+        const auto letters {(range64(p, 'a', 'z') | range64(p, 'A', 'Z') |
+                             ~below64(p, 0x80)) & ~spaces & valid};
+        const auto digits {range64(p, '0', '9') & valid};
+        const std::uint64_t masks[] {spaces, letters, digits,
+                                     valid & ~(spaces | letters | digits)};
+        std::uint64_t edges {0};
+
+        /* A byte starts a run if its class differs from the one before. */
+        for (std::size_t c {0}; c < std::size(masks); ++c) {
+            const auto before {(masks[c] << 1) |
+                               std::uint64_t {scanner.run == ByteClass {
+                                                  static_cast<int>(c)}}};
+
+            edges |= (masks[c] ^ before) & valid;
+        }
+
+        for (; edges != 0; edges &= edges - 1) {
+            const auto bit {static_cast<std::size_t>(std::countr_zero(edges))};
+
+            if (scanner.run != ByteClass::none) {
+                if (carried) {
+                    scanner.partial.append(base + start, base + i + bit);
+                    end_run(scanner, scanner.partial, on_token);
+                    scanner.partial.clear();
+                    carried = false;
+                } else {
+                    end_run(scanner, {base + start, i + bit - start}, on_token);
+                }
+            }
+
+            start = i + bit;
+            scanner.run = masks[0] >> bit & 1   ? ByteClass::space
+                          : masks[1] >> bit & 1 ? ByteClass::letter
+                          : masks[2] >> bit & 1 ? ByteClass::digit
+                                                : ByteClass::other;
+        }
+    }
+
+    if (scanner.run != ByteClass::none) {
+        scanner.partial.append(base + start, base + data.size());
+    }
+}
+
+template <typename F>
+static auto finish_tokens(TokenScanner& scanner, F&& on_token) -> void 
+{
+    using namespace std::string_view_literals;
+
+    if (scanner.run == ByteClass::space) {
+        if (scanner.apostrophe) {
+            on_token(""sv, "'"sv);
+            scanner.apostrophe = false;
+        }
+        on_token(""sv, std::string_view {scanner.partial});
+    } else if (scanner.run != ByteClass::none) {
+        end_run(scanner, scanner.partial, on_token);
+    }
+
+    if (scanner.apostrophe) {
+        on_token(""sv, "'"sv);
+    }
+    scanner = TokenScanner {};
+}
+
+/* Scans the bytes of a chunk up to the end of its head with the scanner of
+ * the bytes before that chunk, and continues with the state of the chunk. */
+template <typename F>
+static auto merge_tokens(TokenScanner& scanner,
+                         const TokenScanner& chunk,
+                         F&& on_token) -> void 
+{
+    scan_tokens(scanner, chunk.head, on_token);
+
+    if (chunk.in_head) {
+        scan_tokens(scanner, chunk.partial, on_token);
+        return;
+    }
+
+    /* The head ends with the whole run before the one the chunk is in, unless
+     * the chunk is the first one. */
+    if (scanner.run != ByteClass::none) {
+        end_run(scanner, scanner.partial, on_token);
+    }
+    scanner.partial = chunk.partial;
+    scanner.run = chunk.run;
+    scanner.space_prefix = chunk.space_prefix;
+    scanner.apostrophe = chunk.apostrophe;
+}
+
+/* A byte pair encoding vocabulary, in the format of tiktoken: a line for each
+ * token, with its bytes in base64 and its rank. */
+class BpeVocabulary {
+public:
+    [[nodiscard]] static auto load(const char* file)
+        -> std::expected<BpeVocabulary, std::string>
+    {
+        auto is {std::ifstream {file}};
+        auto vocabulary {BpeVocabulary {}};
+        auto line {std::string {}};
+        auto token {std::string {}};
+        std::uintmax_t nline {0};
+
+        if (not is.is_open()) {
+            return std::unexpected {
+                std::error_code {errno, std::generic_category()}.message()};
+        }
+
+        while (std::getline(is, line)) {
+            ++nline;
+
+            if (line.empty()) {
+                continue;
+            }
+
+            const auto space {line.find(' ')};
+            const auto rank {space == line.npos
+                ? std::nullopt
+                : parse_unsigned(std::string_view {line}.substr(space + 1))};
+
+            if (not rank or not decode_base64(std::string_view {line}.substr(0, space),
+                                              token)) {
+                return std::unexpected {
+                    std::format("malformed vocabulary at line {}", nline)};
+            }
+            vocabulary.ranks.find(hash_bytes(token), token) = *rank;
+        }
+
+        if (is.bad()) {
+            return std::unexpected {
+                std::error_code {errno, std::generic_category()}.message()};
+        }
+        return vocabulary;
+    }
+
+    /* Returns the number of tokens of piece: starting from its bytes, the
+     * adjacent pair of parts that is the token of the lowest rank is merged,
+     * until no pair is a token. Longer pieces are encoded by parts of
+     * max_piece bytes, which bounds the quadratic cost. */
+    [[nodiscard]] auto count(std::string_view piece) const -> std::uintmax_t
+    {
+        std::uintmax_t ntokens {0};
+
+        for (; piece.size() > max_piece; piece.remove_prefix(max_piece)) {
+            ntokens += count(piece.substr(0, max_piece));
+        }
+
+        if (piece.size() < 2) {
+            return ntokens + piece.size();
+        }
+
+        /* The parts start at starts[0, nparts), and pair_ranks[i] is the rank
+         * of parts i and i + 1 together. */
+        std::array<std::size_t, max_piece + 1> starts {};
+        std::array<std::uintmax_t, max_piece> pair_ranks {};
+        auto nparts {piece.size()};
+        const auto pair_rank {[&](std::size_t i) {
+            if (i + 1 >= nparts) {
+                return UINTMAX_MAX;
+            }
+
+            const auto end {i + 2 < nparts ? starts[i + 2] : piece.size()};
+            const auto pair {piece.substr(starts[i], end - starts[i])};
+            const auto* const rank {ranks.lookup(hash_bytes(pair), pair)};
+
+            return rank ? *rank : UINTMAX_MAX;
+        }};
+
+        for (std::size_t i {0}; i < nparts; ++i) {
+            starts[i] = i;
+        }
+
+        for (std::size_t i {0}; i < nparts; ++i) {
+            pair_ranks[i] = pair_rank(i);
+        }
+
+        while (true) {
+            const auto* const lowest {
+                std::min_element(pair_ranks.data(), pair_ranks.data() + nparts)};
+
+            if (*lowest == UINTMAX_MAX) {
+                break;
+            }
+
+            const auto i {static_cast<std::size_t>(lowest - pair_ranks.data())};
+
+            std::copy(starts.data() + i + 2, starts.data() + nparts,
+                      starts.data() + i + 1);
+            std::copy(pair_ranks.data() + i + 2, pair_ranks.data() + nparts,
+                      pair_ranks.data() + i + 1);
+            --nparts;
+            pair_ranks[i] = pair_rank(i);
+
+            if (i > 0) {
+                pair_ranks[i - 1] = pair_rank(i - 1);
+            }
+        }
+        return ntokens + nparts;
+    }
+
+private:
+    static constexpr std::size_t max_piece {256};
+
+    [[nodiscard]] static auto decode_base64(std::string_view s, std::string& out)
+        -> bool
+    {
+        std::uint32_t bits {0};
+        unsigned nbits {0};
+
+        out.clear();
+
+        while (s.ends_with('=')) {
+            s.remove_suffix(1);
+        }
+
+        for (const char c : s) {
+            const auto value {std::string_view {
+                "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"}
+                                  .find(c)};
+
+            if (value == std::string_view::npos) {
+                return false;
+            }
+
+            bits = (bits << 6) | static_cast<std::uint32_t>(value);
+            nbits += 6;
+
+            if (nbits >= 8) {
+                nbits -= 8;
+                out.push_back(static_cast<char>(bits >> nbits & 0xff));
+            }
+        }
+        return not out.empty();
+    }
+
+    WordTable ranks {};
+};
+
+/* The state of --tokens. With a vocabulary, the number of tokens of each
+ * pre-token is cached, plus one so that 0 is a new entry. */
+struct TokenState {
+    std::shared_ptr<const BpeVocabulary> vocabulary {};
+    std::uintmax_t count {0};
+    TokenScanner scanner {};
+    WordTable cache {};
+    std::string scratch {};
+};
+
+static auto count_token(TokenState& tokens,
+                        std::string_view prefix,
+                        std::string_view body) -> void 
+{
+    /* Past this number of pre-tokens, the cache is dropped. */
+    constexpr std::size_t max_cached {1 << 16};
+
+    if (not tokens.vocabulary) {
+        ++tokens.count;
+        return;
+    }
+
+    auto token {body};
+
+    if (not prefix.empty()) {
+        tokens.scratch.assign(prefix).append(body);
+        token = tokens.scratch;
+    }
+
+    if (tokens.cache.size() >= max_cached) {
+        tokens.cache = WordTable {};
+    }
+
+    auto& cached {tokens.cache.find(hash_bytes(token), token)};
+
+    if (cached == 0) {
+        cached = tokens.vocabulary->count(token) + 1;
+    }
+    tokens.count += cached - 1;
+}
+
+static auto tokens_feed(TokenState& tokens, std::span<const char> data) -> void 
+{
+    scan_tokens(tokens.scanner, data,
+                [&tokens](std::string_view prefix, std::string_view body) {
+                    count_token(tokens, prefix, body);
+                });
+}
+
+static auto tokens_merge(TokenState& tokens, const TokenState& chunk) -> void 
+{
+    tokens.count += chunk.count;
+    merge_tokens(tokens.scanner, chunk.scanner,
+                 [&tokens](std::string_view prefix, std::string_view body) {
+                     count_token(tokens, prefix, body);
+                 });
+}
+
+static auto tokens_finish(TokenState& tokens) -> void 
+{
+    finish_tokens(tokens.scanner,
+                  [&tokens](std::string_view prefix, std::string_view body) {
+                      count_token(tokens, prefix, body);
+                  });
+}
+
+/* Parses from min_digits to max_digits digits at the start of s, which is
+ * advanced past them. */
+[[nodiscard]] static auto parse_digits(std::string_view& s,
+                                       std::size_t min_digits,
+                                       std::size_t max_digits)
+    -> std::optional<std::int64_t> 
+{
+    std::int64_t value {0};
+    std::size_t i {0};
+
+    for (; i < max_digits and i < s.size() and s[i] >= '0' and s[i] <= '9';
+         ++i) {
+        value = value * 10 + (s[i] - '0');
+    }
+
+    if (i < min_digits) {
+        return std::nullopt;
+    }
+
+    s.remove_prefix(i);
+    return value;
+}
+
+/* Parses a zone offset, Z or [+-]HH[:]MM, at the start of s, which is
+ * advanced past it. Returns it in seconds east of UTC. */
+[[nodiscard]] static auto parse_zone(std::string_view& s)
+    -> std::optional<std::int64_t> 
+{
+    if (s.starts_with('Z')) {
+        s.remove_prefix(1);
+        return 0;
+    }
+
+    if (not s.starts_with('+') and not s.starts_with('-')) {
+        return std::nullopt;
+    }
+
+    const std::int64_t sign {s.front() == '-' ? -1 : 1};
+
+    s.remove_prefix(1);
+
+    const auto hours {parse_digits(s, 2, 2)};
+
+    if (s.starts_with(':')) {
+        s.remove_prefix(1);
+    }
+
+    const auto minutes {parse_digits(s, 2, 2)};
+
+    if (not hours or not minutes or *hours > 23 or *minutes > 59) {
+        return std::nullopt;
+    }
+    return sign * (*hours * 3600 + *minutes * 60);
+}
+
+/* The fields of a timestamp, which default to 1970-01-01T00:00:00Z. */
+struct TimeFields {
+    std::int64_t year {1970};
+    std::int64_t month {1};
+    std::int64_t day {1};
+    std::int64_t hour {0};
+    std::int64_t minute {0};
+    std::int64_t second {0};
+    std::int64_t zone {0};
+    std::optional<std::int64_t> epoch {};
+};
+
+/* Parses the timestamp at the start of s, which is advanced past it, as per
+ * a format with the strptime() conversions of time_conversions, where a space
+ * matches any number of blanks. */
+[[nodiscard]] static auto parse_time_fields(std::string_view format,
+                                            std::string_view& s,
+                                            TimeFields& fields) -> bool 
+{
+    constexpr std::string_view months {"janfebmaraprmayjunjulaugsepoctnovdec"};
+
+    for (std::size_t i {0}; i < format.size(); ++i) {
+        if (format[i] == ' ') {
+            while (s.starts_with(' ') or s.starts_with('\t')) {
+                s.remove_prefix(1);
+            }
+            continue;
+        }
+
+        if (format[i] != '%' or i + 1 == format.size()) {
+            if (not s.starts_with(format[i])) {
+                return false;
+            }
+            s.remove_prefix(1);
+            continue;
+        }
+
+        auto field {std::optional<std::int64_t> {}};
+
+        switch (format[++i]) {
+        case 'Y':
+            field = parse_digits(s, 4, 4);
+            fields.year = field.value_or(0);
+            break;
+
+        case 'm':
+            field = parse_digits(s, 1, 2);
+            fields.month = field.value_or(0);
+            break;
+
+        case 'e':
+            if (s.starts_with(' ')) {
+                s.remove_prefix(1);
+            }
+            [[fallthrough]];
+
+        case 'd':
+            field = parse_digits(s, 1, 2);
+            fields.day = field.value_or(0);
+            break;
+
+        case 'b':
+            if (s.size() >= 3) {
+                auto name {std::string(s.substr(0, 3))};
+
+                for (auto& c : name) {
+                    c = static_cast<char>(
+                        std::tolower(static_cast<unsigned char>(c)));
+                }
+
+                if (const auto month {months.find(name)};
+                    month != months.npos and month % 3 == 0) {
+                    fields.month = static_cast<std::int64_t>(month / 3 + 1);
+                    field = fields.month;
+                    s.remove_prefix(3);
+                }
+            }
+            break;
+
+        case 'H':
+            field = parse_digits(s, 1, 2);
+            fields.hour = field.value_or(0);
+            break;
+
+        case 'M':
+            field = parse_digits(s, 1, 2);
+            fields.minute = field.value_or(0);
+            break;
+
+        case 'S':
+            field = parse_digits(s, 1, 2);
+            fields.second = field.value_or(0);
+            break;
+
+        case 'z':
+            field = parse_zone(s);
+            fields.zone = field.value_or(0);
+            break;
+
+        case 's': {
+            const bool negative {s.starts_with('-')};
+
+            if (negative) {
+                s.remove_prefix(1);
+            }
+
+            field = parse_digits(s, 1, 18);
+            fields.epoch = negative ? -field.value_or(0) : field.value_or(0);
+            break;
+        }
+
+        default:
+            if (s.starts_with('%')) {
+                s.remove_prefix(1);
+                field = 0;
+            }
+            break;
+        }
+
+        if (not field) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Parses the timestamp that line starts with, as per format: "iso", for ISO
+ * 8601 dates and times, with T or a space between them, and an optional
+ * fraction of seconds and zone offset, or a format for parse_time_fields().
+ * Returns the time in seconds since the epoch, in UTC if the timestamp has a
+ * zone offset, and the number of bytes of the timestamp. */
+[[nodiscard]] static auto parse_time(std::string_view format,
+                                     std::string_view line)
+    -> std::optional<std::pair<std::int64_t, std::size_t>> 
+{
+    auto s {line};
+    auto fields {TimeFields {}};
+
+    if (format == "iso") {
+        if (not parse_time_fields("%Y-%m-%d", s, fields) or 
+            not (s.starts_with('T') or s.starts_with(' '))) {
+            return std::nullopt;
+        }
+
+        s.remove_prefix(1);
+
+        if (not parse_time_fields("%H:%M:%S", s, fields)) {
+            return std::nullopt;
+        }
+
+        if (s.size() >= 2 and (s[0] == '.' or s[0] == ',') and 
+            s[1] >= '0' and s[1] <= '9') {
+            s.remove_prefix(std::min(s.find_first_not_of("0123456789", 1),
+                                     s.size()));
+        }
+
+        if (auto rest {s}; const auto zone {parse_zone(rest)}) {
+            fields.zone = *zone;
+            s = rest;
+        }
+    } else if (not parse_time_fields(format, s, fields)) {
+        return std::nullopt;
+    }
+
+    const auto size {line.size() - s.size()};
+
+    if (fields.epoch) {
+        return std::pair {*fields.epoch, size};
+    }
+
+    const auto date {std::chrono::year_month_day {
+        std::chrono::year {static_cast<int>(fields.year)},
+        std::chrono::month {static_cast<unsigned>(fields.month)},
+        std::chrono::day {static_cast<unsigned>(fields.day)}}};
+
+    if (not date.ok() or fields.hour > 23 or fields.minute > 59 or 
+        fields.second > 60) {
+        return std::nullopt;
+    }
+
+    const auto days {
+        std::chrono::sys_days {date}.time_since_epoch().count()};
+
+    return std::pair {days * 86400 + fields.hour * 3600 + fields.minute * 60 +
+                          fields.second - fields.zone,
+                      size};
+}
+
+/* Returns the number of words of s, by the rule of feed(). */
+[[nodiscard]] static auto count_words(std::string_view s) -> std::uintmax_t 
+{
+    std::uintmax_t words {0};
+    bool in_word {false};
+
+    for (std::size_t i {0}; i < s.size(); i += 64) {
+        const auto n {std::min<std::size_t>(64, s.size() - i)};
+        const auto mask {~space_mask(s.data() + i, n) & low_bits(n)};
+
+        words += static_cast<std::uintmax_t>(
+            std::popcount(mask & ~((mask << 1) | std::uint64_t {in_word})));
+        in_word = (mask >> (n - 1) & 1) != 0;
+    }
+    return words;
+}
+
+struct BucketCounts {
+    std::uintmax_t lines {0};
+    std::uintmax_t words {0};
+    std::uintmax_t bytes {0};
+
+    auto operator+=(const BucketCounts& other) -> BucketCounts&
+    {
+        lines += other.lines;
+        words += other.words;
+        bytes += other.bytes;
+        return *this;
+    }
+};
+
+/* Line, word and byte counts by time bucket, for --bucket-by-time: a bucket
+ * holds the lines whose timestamp is in [start, start + width), start being a
+ * multiple of width seconds since the epoch, and the lines without one that
+ * follow them. Lines before the first timestamp are counted apart. */
+struct TimeBuckets {
+    std::map<std::int64_t, BucketCounts> buckets {};
+    BucketCounts untimed {};
+};
+
+/* The state of --bucket-by-time. The counts of the bucket of the last
+ * timestamp are kept in current until another bucket starts, and the text of
+ * that timestamp, followed by the byte after it, in last_text, so that lines
+ * that start with the same timestamp need not be parsed. */
+struct BucketState {
+    std::string_view format {};
+    std::int64_t width {1};
+    std::shared_ptr<TimeBuckets> buckets {};
+    std::optional<std::int64_t> start {};
+    BucketCounts current {};
+    std::string last_text {};
+    std::int64_t last_time {0};
+    LineScanner lines {};
+};
+
+static auto end_bucket(BucketState& bucket) -> void 
+{
+    if (bucket.start) {
+        bucket.buckets->buckets[*bucket.start] += bucket.current;
+        bucket.current = BucketCounts {};
+    }
+}
+
+/* newline is whether the line was ended by a newline. */
+static auto bucket_line(BucketState& bucket, std::string_view line,
+                        bool newline) -> void 
+{
+    auto time {std::optional<std::int64_t> {}};
+    const auto& text {bucket.last_text};
+
+    if (not text.empty() and line.size() + 1 >= text.size() and 
+        std::memcmp(line.data(), text.data(), text.size() - 1) == 0 and 
+        (line.size() + 1 == text.size() ? '\n' : line[text.size() - 1]) ==
+            text.back()) {
+        time = bucket.last_time;
+    } else if (const auto parsed {parse_time(bucket.format, line)}) {
+        time = bucket.last_time = parsed->first;
+        bucket.last_text.assign(line.substr(0, parsed->second));
+        bucket.last_text.push_back(
+            parsed->second < line.size() ? line[parsed->second] : '\n');
+    }
+
+    if (time) {
+        /* Rounded down, as the time may be negative. */
+        const auto start {(*time / bucket.width -
+                           (*time % bucket.width < 0 ? 1 : 0)) * bucket.width};
+
+        if (start != bucket.start) {
+            end_bucket(bucket);
+            bucket.start = start;
+        }
+    }
+
+    auto& counts {bucket.start ? bucket.current : bucket.buckets->untimed};
+
+    ++counts.lines;
+    counts.words += count_words(line);
+    counts.bytes += line.size() + (newline ? 1 : 0);
+}
+
+static auto bucket_feed(BucketState& bucket, std::span<const char> data)
+    -> void 
+{
+    scan_lines(bucket.lines, data, [&bucket](std::string_view line) {
+        bucket_line(bucket, line, true);
+    });
+}
+
+/* A chunk starts on a line, and its lines before its first timestamp belong
+ * to the bucket of the last timestamp before it. */
+static auto bucket_merge(BucketState& bucket, const BucketState& chunk) -> void 
+{
+    auto& counts {bucket.start ? bucket.current : bucket.buckets->untimed};
+
+    counts += chunk.buckets->untimed;
+
+    if (chunk.start) {
+        end_bucket(bucket);
+
+        for (const auto& [start, chunk_counts] : chunk.buckets->buckets) {
+            bucket.buckets->buckets[start] += chunk_counts;
+        }
+
+        bucket.start = chunk.start;
+        bucket.current = chunk.current;
+        bucket.last_text = chunk.last_text;
+        bucket.last_time = chunk.last_time;
+    }
+    bucket.lines = chunk.lines;
+}
+
+static auto bucket_finish(BucketState& bucket) -> void 
+{
+    if (bucket.lines.open) {
+        bucket_line(bucket, bucket.lines.partial, false);
+        bucket.lines = LineScanner {};
+    }
+    end_bucket(bucket);
+}
+
+/* The reflected polynomial of CRC-32C (Castagnoli). */
+constexpr std::uint32_t crc32c_polynomial {0x82f63b78};
+
+/* CRC-32C registers, reflected as the polynomials they stand for: bit 31 is
+ * the coefficient of x^0. Returns a * b modulo the polynomial. */
+[[nodiscard]] static auto crc32c_multiply(std::uint32_t a, std::uint32_t b)
+    -> std::uint32_t 
+{
+    std::uint32_t product {0};
+
+    for (std::uint32_t m {1U << 31}; m != 0; m >>= 1) {
+        if (a & m) {
+            product ^= b;
+        }
+        b = b & 1 ? (b >> 1) ^ crc32c_polynomial : b >> 1;
+    }
+    return product;
+}
+
+/* Returns x^n modulo the polynomial. */
+[[nodiscard]] static auto crc32c_power(std::uint64_t n) -> std::uint32_t 
+{
+    std::uint32_t power {1U << 31};
+    std::uint32_t square {1U << 30}; /* x^1 */
+
+    for (; n != 0; n >>= 1) {
+        if (n & 1) {
+            power = crc32c_multiply(power, square);
+        }
+        square = crc32c_multiply(square, square);
+    }
+    return power;
+}
+
+/* Returns the register after size zero bytes are fed to crc, so that the
+ * register of a concatenation is shift(crc of the first part, size of the
+ * second) ^ crc of the second part from a zero register. */
+[[nodiscard]] static auto crc32c_shift(std::uint32_t crc, std::uint64_t size)
+    -> std::uint32_t 
+{
+    return crc32c_multiply(crc32c_power(8 * size), crc);
+}
+
+[[nodiscard]] static auto crc32c_software(std::uint32_t crc,
+                                          std::span<const char> data)
+    -> std::uint32_t 
+{
+    static constexpr auto table {[] {
+        auto table {std::array<std::uint32_t, 256> {}};
+
+        for (std::uint32_t i {0}; i < table.size(); ++i) {
+            auto crc {i};
+
+            for (int bit {0}; bit < 8; ++bit) {
+                crc = crc & 1 ? (crc >> 1) ^ crc32c_polynomial : crc >> 1;
+            }
+            table[i] = crc;
+        }
+        return table;
+    }()};
+
+    for (const char c : data) {
+        crc = table[(crc ^ static_cast<unsigned char>(c)) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+/* Feeds data to crc with the CRC32 instruction of SSE4.2. Its latency is
+ * three times its throughput, so long inputs are fed as three interleaved
+ * streams, which are then joined by shifting the first two with a carry-less
+ * multiplication: the product of crc and x^(8n - 33) fed as 8 bytes to a zero
+ * register is crc shifted by n bytes. */
+[[gnu::target("sse4.2,pclmul")]] [[nodiscard]] static auto crc32c_hardware(
+    std::uint32_t crc, std::span<const char> data) -> std::uint32_t 
+{
+    constexpr std::size_t stream_size {1024};
+    static const auto shift_one {_mm_set_epi64x(
+        0, static_cast<long long>(crc32c_power(8 * stream_size - 33)))};
+    static const auto shift_two {_mm_set_epi64x(
+        0, static_cast<long long>(crc32c_power(16 * stream_size - 33)))};
+    const char* p {data.data()};
+    auto n {data.size()};
+    std::uint64_t crc0 {crc};
+
+    for (; n >= 3 * stream_size; n -= 3 * stream_size, p += 3 * stream_size) {
+        std::uint64_t crc1 {0};
+        std::uint64_t crc2 {0};
+
+        for (std::size_t i {0}; i < stream_size; i += 8) {
+            crc0 = _mm_crc32_u64(crc0, load64(p + i));
+            crc1 = _mm_crc32_u64(crc1, load64(p + stream_size + i));
+            crc2 = _mm_crc32_u64(crc2, load64(p + 2 * stream_size + i));
+        }
+
+        const auto shifted {_mm_xor_si128(
+            _mm_clmulepi64_si128(_mm_cvtsi64_si128(static_cast<long long>(crc0)),
+                                 shift_two, 0),
+            _mm_clmulepi64_si128(_mm_cvtsi64_si128(static_cast<long long>(crc1)),
+                                 shift_one, 0))};
+
+        crc0 = _mm_crc32_u64(
+                   0, static_cast<std::uint64_t>(_mm_cvtsi128_si64(shifted))) ^
+               crc2;
+    }
+
+    for (; n >= 8; n -= 8, p += 8) {
+        crc0 = _mm_crc32_u64(crc0, load64(p));
+    }
+
+    auto crc32 {static_cast<std::uint32_t>(crc0)};
+
+    for (; n != 0; --n, ++p) {
+        crc32 = _mm_crc32_u8(crc32, static_cast<unsigned char>(*p));
+    }
+    return crc32;
+}
+#endif
+
+/* Feeds data to the CRC-32C register crc, which starts as 0xffffffff and
+ * ends inverted. */
+[[nodiscard]] static auto crc32c(std::uint32_t crc, std::span<const char> data)
+    -> std::uint32_t 
+{
+#if defined(__x86_64__)
+    static const bool hardware {__builtin_cpu_supports("sse4.2") and
+                                __builtin_cpu_supports("pclmul")};
+
+    if (hardware) {
+        return crc32c_hardware(crc, data);
+    }
+#endif
+    return crc32c_software(crc, data);
+}
+
+[[nodiscard]] static auto load32(const char* p) -> std::uint32_t 
+{
+    std::uint32_t v {};
+
+    std::memcpy(&v, p, sizeof v);
+    return v;
+}
+
+[[nodiscard]] static auto load16(const char* p) -> std::uint16_t 
+{
+    std::uint16_t v {};
+
+    std::memcpy(&v, p, sizeof v);
+    return v;
+}
+
+/* The 64-bit XXH3 hash, with the default secret and seed 0, fed in parts. As
+ * in the reference implementation, inputs of up to 240 bytes are hashed at
+ * once by digest(), and longer ones by 64-byte stripes, 16 to a block, each
+ * of which is accumulated into 8 lanes keyed by 8 bytes further into the
+ * secret than the one before; the lanes are scrambled after each block. The
+ * last stripe is always the last 64 bytes of the input, so the stripes that
+ * are known to be followed by more bytes are consumed, and the last bytes are
+ * kept in buffer, after the last stripe consumed. */
+class Xxh3 {
+public:
+    auto update(std::span<const char> data) -> void
+    {
+        size += data.size();
+
+        if (data.size() <= buffer.size() - buffered) {
+            std::ranges::copy(data, buffer.begin() + static_cast<std::ptrdiff_t>(buffered));
+            buffered += data.size();
+            return;
+        }
+
+        if (buffered != 0) {
+            const auto fill {buffer.size() - buffered};
+
+            std::ranges::copy(data.first(fill),
+                              buffer.begin() + static_cast<std::ptrdiff_t>(buffered));
+            data = data.subspan(fill);
+            consume_stripes(lanes, stripes, buffer.data(),
+                            buffer.size() / stripe_size);
+            buffered = 0;
+        }
+
+        if (data.size() > buffer.size()) {
+            const auto nstripes {(data.size() - 1) / stripe_size};
+
+            consume_stripes(lanes, stripes, data.data(), nstripes);
+            data = data.subspan(nstripes * stripe_size);
+            std::memcpy(buffer.data() + buffer.size() - stripe_size,
+                        data.data() - stripe_size, stripe_size);
+        }
+
+        std::ranges::copy(data, buffer.begin());
+        buffered = data.size();
+    }
+
+    [[nodiscard]] auto digest() const -> std::uint64_t
+    {
+        if (size <= 240) {
+            return hash_short({buffer.data(), buffered});
+        }
+
+        auto acc {lanes};
+        auto nstripes {stripes};
+        char last[stripe_size] {};
+
+        if (buffered >= stripe_size) {
+            consume_stripes(acc, nstripes, buffer.data(),
+                            (buffered - 1) / stripe_size);
+            std::memcpy(last, buffer.data() + buffered - stripe_size,
+                        stripe_size);
+        } else {
+            const auto catchup {stripe_size - buffered};
+
+            std::memcpy(last, buffer.data() + buffer.size() - catchup, catchup);
+            std::memcpy(last + catchup, buffer.data(), buffered);
+        }
+
+        accumulate(acc, last, secret_bytes() + secret_size - stripe_size - 7);
+        return merge_lanes(acc, secret_bytes() + 11, size * prime64_1);
+    }
+
+private:
+    static constexpr std::size_t stripe_size {64};
+    static constexpr std::size_t secret_size {192};
+    static constexpr std::size_t stripes_per_block {(secret_size - stripe_size) / 8};
+    static constexpr std::uint64_t prime32_1 {0x9e3779b1};
+    static constexpr std::uint64_t prime32_2 {0x85ebca77};
+    static constexpr std::uint64_t prime32_3 {0xc2b2ae3d};
+    static constexpr std::uint64_t prime64_1 {0x9e3779b185ebca87};
+    static constexpr std::uint64_t prime64_2 {0xc2b2ae3d27d4eb4f};
+    static constexpr std::uint64_t prime64_3 {0x165667b19e3779f9};
+    static constexpr std::uint64_t prime64_4 {0x85ebca77c2b2ae63};
+    static constexpr std::uint64_t prime64_5 {0x27d4eb2f165667c5};
+    static constexpr std::uint64_t prime_mx1 {0x165667919e3779f9};
+    static constexpr std::uint64_t prime_mx2 {0x9fb21c651e98df25};
+
+    using Lanes = std::array<std::uint64_t, 8>;
+
+    [[nodiscard]] static auto secret_bytes() -> const char* 
+    {
+        static constexpr unsigned char secret[secret_size] {
+            0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c,
+            0xf7, 0x21, 0xad, 0x1c, 0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+            0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f, 0xcb, 0x79, 0xe6, 0x4e,
+            0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+            0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6,
+            0x81, 0x3a, 0x26, 0x4c, 0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb,
+            0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3, 0x71, 0x64, 0x48, 0x97,
+            0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+            0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7,
+            0xc7, 0x0b, 0x4f, 0x1d, 0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+            0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64, 0xea, 0xc5, 0xac, 0x83,
+            0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+            0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26,
+            0x29, 0xd4, 0x68, 0x9e, 0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc,
+            0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce, 0x45, 0xcb, 0x3a, 0x8f,
+            0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+        };
+
+        return reinterpret_cast<const char*>(secret);
+    }
+
+    [[nodiscard]] static auto secret64(std::size_t offset) -> std::uint64_t 
+    {
+        return load64(secret_bytes() + offset);
+    }
+
+    /* Returns the XOR of the high and low halves of the 128-bit a * b. */
+    [[nodiscard]] static auto multiply_fold(std::uint64_t a, std::uint64_t b)
+        -> std::uint64_t 
+    {
+        const auto low_low {(a & 0xffffffff) * (b & 0xffffffff)};
+        const auto high_low {(a >> 32) * (b & 0xffffffff)};
+        const auto low_high {(a & 0xffffffff) * (b >> 32)};
+        const auto high_high {(a >> 32) * (b >> 32)};
+        const auto cross {(low_low >> 32) + (high_low & 0xffffffff) + low_high};
+        const auto high {(high_low >> 32) + (cross >> 32) + high_high};
+        const auto low {(cross << 32) | (low_low & 0xffffffff)};
+
+        return low ^ high;
+    }
+
+    [[nodiscard]] static auto avalanche(std::uint64_t h) -> std::uint64_t 
+    {
+        h ^= h >> 37;
+        h *= prime_mx1;
+        return h ^ (h >> 32);
+    }
+
+    [[nodiscard]] static auto avalanche64(std::uint64_t h) -> std::uint64_t 
+    {
+        h ^= h >> 33;
+        h *= prime64_2;
+        h ^= h >> 29;
+        h *= prime64_3;
+        return h ^ (h >> 32);
+    }
+
+    [[nodiscard]] static auto mix16(const char* p, std::size_t secret)
+        -> std::uint64_t 
+    {
+        return multiply_fold(load64(p) ^ secret64(secret),
+                             load64(p + 8) ^ secret64(secret + 8));
+    }
+
+    [[nodiscard]] static auto hash_short(std::span<const char> data)
+        -> std::uint64_t 
+    {
+        const char* const p {data.data()};
+        const std::uint64_t n {data.size()};
+
+        if (n == 0) {
+            return avalanche64(secret64(56) ^ secret64(64));
+        }
+
+        if (n <= 3) {
+            const auto c1 {std::uint64_t {static_cast<unsigned char>(p[0])}};
+            const auto c2 {std::uint64_t {static_cast<unsigned char>(p[n >> 1])}};
+            const auto c3 {std::uint64_t {static_cast<unsigned char>(p[n - 1])}};
+            const auto combined {(c1 << 16) | (c2 << 24) | c3 | (n << 8)};
+
+            return avalanche64(combined ^ (load32(secret_bytes()) ^ 
+                                           load32(secret_bytes() + 4)));
+        }
+
+        if (n <= 8) {
+            const auto input {load32(p + n - 4) + 
+                              (std::uint64_t {load32(p)} << 32)};
+            auto h {input ^ (secret64(8) ^ secret64(16))};
+
+            h ^= std::rotl(h, 49) ^ std::rotl(h, 24);
+            h *= prime_mx2;
+            h ^= (h >> 35) + n;
+            h *= prime_mx2;
+            return h ^ (h >> 28);
+        }
+
+        if (n <= 16) {
+            const auto low {load64(p) ^ (secret64(24) ^ secret64(32))};
+            const auto high {load64(p + n - 8) ^ (secret64(40) ^ secret64(48))};
+
+            return avalanche(n + std::byteswap(low) + high + 
+                             multiply_fold(low, high));
+        }
+
+        auto acc {n * prime64_1};
+
+        if (n <= 128) {
+            if (n > 32) {
+                if (n > 64) {
+                    if (n > 96) {
+                        acc += mix16(p + 48, 96);
+                        acc += mix16(p + n - 64, 112);
+                    }
+                    acc += mix16(p + 32, 64);
+                    acc += mix16(p + n - 48, 80);
+                }
+                acc += mix16(p + 16, 32);
+                acc += mix16(p + n - 32, 48);
+            }
+            acc += mix16(p, 0);
+            acc += mix16(p + n - 16, 16);
+            return avalanche(acc);
+        }
+
+        for (std::size_t i {0}; i < 8; ++i) {
+            acc += mix16(p + 16 * i, 16 * i);
+        }
+
+        acc = avalanche(acc);
+
+        for (std::size_t i {8}; i < n / 16; ++i) {
+            acc += mix16(p + 16 * i, 16 * (i - 8) + 3);
+        }
+
+        acc += mix16(p + n - 16, 136 - 17);
+        return avalanche(acc);
+    }
+
+    static auto accumulate(Lanes& acc, const char* p, const char* key) -> void
+    {
+#if defined(__SSE2__)
+        for (std::size_t i {0}; i < acc.size(); i += 2) {
+            auto* const lanes {reinterpret_cast<__m128i*>(acc.data() + i)};
+            const auto data {_mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(p + 8 * i))};
+            const auto keyed {_mm_xor_si128(data, _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(key + 8 * i)))};
+            const auto product {_mm_mul_epu32(
+                keyed, _mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)))};
+            const auto sum {_mm_add_epi64(
+                _mm_loadu_si128(lanes),
+                _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2)))};
+
+            _mm_storeu_si128(lanes, _mm_add_epi64(product, sum));
+        }
+#else
+        for (std::size_t i {0}; i < acc.size(); ++i) {
+            const auto data {load64(p + 8 * i)};
+            const auto keyed {data ^ load64(key + 8 * i)};
+
+            acc[i ^ 1] += data;
+            acc[i] += (keyed & 0xffffffff) * (keyed >> 32);
+        }
+#endif
+    }
+
+    static auto scramble(Lanes& acc) -> void
+    {
+        for (std::size_t i {0}; i < acc.size(); ++i) {
+            acc[i] = (acc[i] ^ (acc[i] >> 47) ^ 
+                      secret64(secret_size - stripe_size + 8 * i)) * prime32_1;
+        }
+    }
+
+    static auto consume_stripes(Lanes& acc,
+                                std::size_t& stripes,
+                                const char* p,
+                                std::size_t nstripes) -> void
+    {
+        for (; nstripes != 0; --nstripes, p += stripe_size) {
+            accumulate(acc, p, secret_bytes() + 8 * stripes);
+
+            if (++stripes == stripes_per_block) {
+                scramble(acc);
+                stripes = 0;
+            }
+        }
+    }
+
+    [[nodiscard]] static auto merge_lanes(const Lanes& acc,
+                                          const char* key,
+                                          std::uint64_t start) -> std::uint64_t 
+    {
+        for (std::size_t i {0}; i < acc.size(); i += 2) {
+            start += multiply_fold(acc[i] ^ load64(key + 8 * i),
+                                   acc[i + 1] ^ load64(key + 8 * i + 8));
+        }
+        return avalanche(start);
+    }
+
+    Lanes lanes {prime32_3, prime64_1, prime64_2, prime64_3,
+                 prime64_4, prime32_2, prime64_5, prime32_1};
+    std::size_t stripes {0};
+    std::array<char, 256> buffer {};
+    std::size_t buffered {0};
+    std::uint64_t size {0};
+};
+
+/* The state of --hash. The CRC-32C register of a chunk starts at 0, to be
+ * shifted past it and combined with the register of the bytes before it. */
+struct HashState {
+    HashAlgorithm algorithm {HashAlgorithm::none};
+    std::uint32_t crc {0xffffffff};
+    Xxh3 xxh3 {};
+};
+
+static auto hash_feed(HashState& hash, std::span<const char> data) -> void 
+{
+    if (hash.algorithm == HashAlgorithm::crc32c) {
+        hash.crc = crc32c(hash.crc, data);
+    } else {
+        hash.xxh3.update(data);
+    }
+}
+
+/* The state of --approx-distinct. */
+struct ApproxState {
+    std::shared_ptr<HyperLogLog> sketch {};
+    LineScanner lines {};
+    WordScanner words {};
+};
+
+static auto approx_feed(ApproxState& approx, 
+                        ApproxDistinct what,
+                        std::span<const char> data) -> void 
+{
+    const auto add {[&approx](std::string_view s) {
+        approx.sketch->add(hash_bytes(s));
+    }};
+
+    if (what == ApproxDistinct::lines) {
+        scan_lines(approx.lines, data, add);
+    } else {
+        scan_words(approx.words, data, add);
+    }
+}
+
+static auto approx_finish(ApproxState& approx) -> void 
+{
+    const auto add {[&approx](std::string_view s) {
+        approx.sketch->add(hash_bytes(s));
+    }};
+
+    finish_lines(approx.lines, add);
+    finish_words(approx.words, add);
+}
+
+/* The counting state of one input. Buffers are fed to it in order. A counter
+ * of a chunk of a file split for parallel counting is merged into the counter
+ * of the bytes preceding that chunk, which must end with a newline. */
+struct Counter {
+    FileStatistics stats {};
+    std::uintmax_t line_pos {0};
+    bool in_word {false};
+    std::optional<CsvState> csv {};
+    std::optional<JsonlState> jsonl {};
+    std::optional<SlocState> sloc {};
+    std::optional<DistinctState> distinct {};
+    std::optional<ApproxState> approx {};
+    std::optional<TopWordsState> top_words {};
+    std::optional<TokenState> tokens {};
+    std::optional<BucketState> bucket {};
+    std::optional<HashState> hash {};
+};
+
+/* file is the counter of the input that the counter is for a chunk of, which
+ * counts in the sketches of file, or null. chunk is whether the chunk does
+ * not start the input. language is the index in languages of the language of
+ * the input, or -1. */
+[[nodiscard]] static auto make_counter(const Options& options,
+                                       const Counter* file,
+                                       bool chunk,
+                                       int language) -> Counter 
+{
+    auto counter {Counter {}};
+
+    if (options.count_csv) {
+        counter.csv.emplace();
+        counter.csv->chunk = chunk;
+
+        if (chunk) {
+            counter.csv->scans[0].in_head = counter.csv->scans[1].in_head = true;
+            counter.csv->scans[1].in_quotes = true;
+        }
+    }
+
+    if (options.count_jsonl) {
+        counter.jsonl.emplace();
+    }
+
+    if (options.count_sloc and language != -1) {
+        counter.stats.sloc_language = language;
+        sloc_init(counter.sloc.emplace(),
+                  languages[static_cast<std::size_t>(language)]);
+    }
+
+    if (options.count_distinct_lines) {
+        counter.distinct.emplace().lines =
+            std::make_shared<DistinctLines>(options.distinct_memory, 0U,
+                                            *options.budget);
+    }
+
+    if (options.approx_distinct != ApproxDistinct::none) {
+        counter.approx.emplace().sketch =
+            std::make_shared<HyperLogLog>(options.hll_precision);
+    }
+
+    if (options.top_words != 0) {
+        counter.top_words.emplace().frequencies = file
+            ? file->top_words->frequencies->share()
+            : std::make_shared<WordFrequencies>(options.top_words,
+                                                options.top_words_sketch,
+                                                *options.budget);
+    }
+
+    if (options.count_tokens) {
+        auto& tokens {counter.tokens.emplace()};
+
+        tokens.vocabulary = options.vocabulary;
+        tokens.scanner.in_head = chunk;
+    }
+
+    if (options.bucket_width != 0) {
+        auto& bucket {counter.bucket.emplace()};
+
+        bucket.format = options.bucket_format;
+        bucket.width = options.bucket_width;
+        bucket.buckets = std::make_shared<TimeBuckets>();
+    }
+
+    if (options.hash != HashAlgorithm::none) {
+        auto& hash {counter.hash.emplace()};
+
+        hash.algorithm = options.hash;
+
+        if (chunk) {
+            hash.crc = 0;
+        }
+    }
+    return counter;
+}
+
+[[nodiscard]] static auto make_counter(const Options& options,
+                                       bool chunk,
+                                       int language) -> Counter 
+{
+    return make_counter(options, nullptr, chunk, language);
+}
+
+static auto feed(Counter& counter, 
+                 const Options& options, 
+                 std::span<const char> data) -> void 
+{
+    auto& stats {counter.stats};
+    auto line_pos {counter.line_pos};
+    auto in_word {counter.in_word};
+    constexpr std::size_t tab_width {8};
+
+    stats.bytes += data.size();
+
+    if (options.count_lines or options.count_max_line_length or
+        options.count_words) {
+        for (const char ch : data) {
+            const auto c {static_cast<unsigned char>(ch)};
+
+            switch (c) {
+            case '\n':
+                ++stats.lines;
+                [[fallthrough]];
+
+            case '\r':
+            case '\f':
+                stats.max_line_length =
+                    std::max(line_pos, stats.max_line_length);
+                line_pos = 0;
+                in_word = false;
+                break;
+
+            case '\t':
+                line_pos += tab_width - (line_pos % tab_width);
+                in_word = false;
+                break;
+
+            case ' ':
+                ++line_pos;
+                [[fallthrough]];
+
+            case '\v':
+                in_word = false;
+                break;
+
+            default:
+                line_pos += isprint(c) != 0;
+                const bool in_word2 = !isspace(c);
+                stats.words += !in_word & in_word2;
+                in_word = in_word2;
+                break;
+            }
+        }
+    }
+
+    counter.line_pos = line_pos;
+    counter.in_word = in_word;
+
+    if (counter.csv) {
+        csv_feed(*counter.csv, data);
+    }
+
+    if (counter.jsonl) {
+        jsonl_feed(*counter.jsonl, data);
+    }
+
+    if (counter.sloc) {
+        sloc_feed(*counter.sloc, data);
+    }
+
+    if (counter.distinct) {
+        distinct_feed(*counter.distinct, data);
+    }
+
+    if (counter.approx) {
+        approx_feed(*counter.approx, options.approx_distinct, data);
+    }
+
+    if (counter.top_words) {
+        top_words_feed(*counter.top_words, data);
+    }
+
+    if (counter.tokens) {
+        tokens_feed(*counter.tokens, data);
+    }
+
+    if (counter.bucket) {
+        bucket_feed(*counter.bucket, data);
+    }
+
+    if (counter.hash) {
+        hash_feed(*counter.hash, data);
+    }
+}
+
+static auto merge(Counter& counter, const Counter& chunk) -> void 
+{
+    /* A chunk without a newline is all head, and leaves the state where its
+     * head did. */
+    if (chunk.stats.bytes == 0) {
+        return;
+    }
+
+    counter.stats.lines += chunk.stats.lines;
+    counter.stats.words += chunk.stats.words;
+    counter.stats.bytes += chunk.stats.bytes;
+    counter.stats.max_line_length =
+        std::max(chunk.stats.max_line_length, counter.stats.max_line_length);
+    counter.line_pos = chunk.line_pos;
+    counter.in_word = chunk.in_word;
+
+    if (counter.csv) {
+        csv_merge(counter.csv->scans[0], *chunk.csv);
+    }
+
+    if (counter.jsonl) {
+        jsonl_merge(*counter.jsonl, *chunk.jsonl);
+    }
+
+    if (counter.distinct) {
+        counter.distinct->lines->merge(*chunk.distinct->lines);
+        counter.distinct->scanner = chunk.distinct->scanner;
+    }
+
+    if (counter.approx) {
+        static_cast<void>(counter.approx->sketch->merge(*chunk.approx->sketch));
+        counter.approx->lines = chunk.approx->lines;
+        counter.approx->words = chunk.approx->words;
+    }
+
+    if (counter.top_words) {
+        counter.top_words->frequencies->merge(*chunk.top_words->frequencies);
+        counter.top_words->scanner = chunk.top_words->scanner;
+    }
+
+    if (counter.tokens) {
+        tokens_merge(*counter.tokens, *chunk.tokens);
+    }
+
+    if (counter.bucket) {
+        bucket_merge(*counter.bucket, *chunk.bucket);
+    }
+
+    if (counter.hash and chunk.hash) {
+        counter.hash->crc = crc32c_shift(counter.hash->crc, chunk.stats.bytes) ^ 
+                            chunk.hash->crc;
+    }
+}
+
+[[nodiscard]] static auto finish(Counter& counter)
+    -> std::expected<FileStatistics, bool> 
+{
+    auto stats {counter.stats};
+
+    /* Replaced by the size of the file for a compressed input. */
+    stats.compressed_bytes = stats.bytes;
+
+    stats.max_line_length = std::max(counter.line_pos, stats.max_line_length);
+
+    if (counter.csv) {
+        auto& scan {counter.csv->scans[0]};
+
+        end_record(scan);
+        stats.csv_records = scan.records;
+        stats.csv_min_fields = scan.records != 0 ? scan.min_fields : 0;
+        stats.csv_max_fields = scan.max_fields;
+    }
+
+    if (counter.jsonl) {
+        auto& jsonl {*counter.jsonl};
+
+        /* A last line without a terminating newline still counts. */
+        if (jsonl.offset != jsonl.line_start) {
+            jsonl_end_line(jsonl, jsonl.offset);
+        }
+
+        stats.jsonl_records = jsonl.records;
+        stats.jsonl_empty = jsonl.empty;
+        stats.jsonl_malformed = jsonl.malformed;
+        stats.jsonl_first_malformed = jsonl.first_malformed;
+    }
+
+    if (counter.sloc) {
+        sloc_finish(*counter.sloc);
+        stats.sloc_code = counter.sloc->code;
+        stats.sloc_comment = counter.sloc->comment;
+        stats.sloc_blank = counter.sloc->blank;
+    }
+
+    if (counter.distinct) {
+        distinct_finish(*counter.distinct);
+        stats.distinct_lines = counter.distinct->lines->count();
+        stats.distinct = counter.distinct->lines;
+
+        if (const int error {stats.distinct->error()}; error != 0) {
+            errno = error;
+            return std::unexpected {false};
+        }
+    }
+
+    if (counter.approx) {
+        approx_finish(*counter.approx);
+        stats.approx_distinct = counter.approx->sketch->estimate();
+        stats.sketch = counter.approx->sketch;
+    }
+
+    if (counter.top_words) {
+        top_words_finish(*counter.top_words);
+        stats.word_frequencies = counter.top_words->frequencies;
+    }
+
+    if (counter.tokens) {
+        tokens_finish(*counter.tokens);
+        stats.tokens = counter.tokens->count;
+    }
+
+    if (counter.bucket) {
+        bucket_finish(*counter.bucket);
+        stats.buckets = counter.bucket->buckets;
+    }
+
+    if (counter.hash) {
+        stats.hash = counter.hash->algorithm == HashAlgorithm::crc32c
+            ? ~counter.hash->crc
+            : counter.hash->xxh3.digest();
+    }
+    return stats;
+}
+
+/* A NUMA node, with those of its CPUs that this process may run on. */
+struct NumaNode {
+    int id {0};
+    cpu_set_t cpus {};
+};
+
+/* Parses a CPU list of sysfs, such as "0-3,8-11". */
+[[nodiscard]] static auto parse_cpu_list(std::string_view list) -> cpu_set_t 
+{
+    auto cpus {cpu_set_t {}};
+
+    CPU_ZERO(&cpus);
+
+    while (not list.empty()) {
+        const auto comma {list.find(',')};
+        const auto range {list.substr(0, comma)};
+        const auto dash {range.find('-')};
+        const auto first {parse_unsigned(range.substr(0, dash))};
+        const auto last {dash == std::string_view::npos
+                             ? first
+                             : parse_unsigned(range.substr(dash + 1))};
+
+        if (first and last) {
+            const auto end {std::min(*last + 1, std::uintmax_t {CPU_SETSIZE})};
+
+            for (auto cpu {*first}; cpu < end; ++cpu) {
+                CPU_SET(cpu, &cpus);
+            }
+        }
+        list.remove_prefix(comma == std::string_view::npos ? list.size()
+                                                           : comma + 1);
+    }
+    return cpus;
+}
+
+#if defined(WITHOUT_NUMA)
+/* Built to compare with, by make bench: workers run on any CPU, and chunks on
+ * any worker. */
+[[nodiscard]] static auto numa_nodes() -> std::vector<NumaNode> 
+{
+    return {};
+}
+#else
+/* Returns the NUMA nodes that this process may run on, in order of id, or
+ * none if there is only one, as then where threads run and memory is placed
+ * makes no difference. */
+[[nodiscard]] static auto numa_nodes() -> std::vector<NumaNode> 
+{
+    auto allowed {cpu_set_t {}};
+    auto nodes {std::vector<NumaNode> {}};
+    auto error {std::error_code {}};
+
+    if (::sched_getaffinity(0, sizeof allowed, &allowed) != 0) {
+        return {};
+    }
+
+    for (const auto& entry : std::filesystem::directory_iterator {
+             "/sys/devices/system/node", error}) {
+        const auto name {entry.path().filename().string()};
+        const auto id {name.starts_with("node")
+                           ? parse_unsigned(std::string_view {name}.substr(4))
+                           : std::nullopt};
+        auto list {std::string {}};
+
+        if (not id or
+            not std::getline(std::ifstream {entry.path() / "cpulist"}, list)) {
+            continue;
+        }
+
+        auto node {NumaNode {static_cast<int>(*id), parse_cpu_list(list)}};
+
+        CPU_AND(&node.cpus, &node.cpus, &allowed);
+
+        if (CPU_COUNT(&node.cpus) > 0) {
+            nodes.push_back(node);
+        }
+    }
+
+    if (nodes.size() < 2) {
+        return {};
+    }
+
+    std::ranges::sort(nodes, {}, &NumaNode::id);
+    return nodes;
+}
+#endif
+
+/* Returns the NUMA node of the memory of the page at address, or -1 if it
+ * cannot be told. get_mempolicy() faults the page in, so a page that is not
+ * in memory is left for the worker that counts it to read, rather than read
+ * here, one page at a time. */
+[[nodiscard]] static auto page_node(const void* address) -> int 
+{
+    const auto page_size {static_cast<std::uintptr_t>(::sysconf(_SC_PAGESIZE))};
+    const auto page {reinterpret_cast<std::uintptr_t>(address) / page_size *
+                     page_size};
+    unsigned char resident {0};
+    int node {-1};
+
+    if (::mincore(reinterpret_cast<void*>(page), 1, &resident) != 0 or
+        (resident & 1) == 0) {
+        return -1;
+    }
+
+    if (::syscall(SYS_get_mempolicy, &node, nullptr, 0, address,
+                  MPOL_F_NODE | MPOL_F_ADDR) != 0) {
+        return -1;
+    }
+    return node;
+}
+
+/* A fixed set of worker threads that run queued tasks in FIFO order. A thread
+ * that waits for a task runs queued tasks until none are left, so that tasks
+ * can wait for tasks they submit without starving the workers.
+ *
+ * On a machine with several NUMA nodes, the workers are spread over the nodes
+ * and each runs only on the CPUs of its own, so that the memory it allocates
+ * is local to it, and runs the tasks submitted near memory on its node before
+ * any others. */
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned nthreads)
+        : ThreadPool {nthreads, false}
+    {
+    }
+
+    /* A limited pool runs no more tasks at once than it has threads: waiting
+     * on it does not run its tasks. */
+    ThreadPool(unsigned nthreads, bool limited)
+        : limited {limited}
+    {
+        for (unsigned i {0}; i < nthreads; ++i) {
+            const auto node {nodes.empty() ? no_node : i % nodes.size()};
+
+            workers.emplace_back([this, node] { work(node); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    auto operator=(const ThreadPool&) -> ThreadPool& = delete;
+
+    ~ThreadPool()
+    {
+        {
+            const auto lock {std::lock_guard {mutex}};
+            stopping = true;
+        }
+        cv.notify_all();
+
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    [[nodiscard]] auto size() const -> std::size_t
+    {
+        return workers.size();
+    }
+
+    template <typename F>
+    [[nodiscard]] auto submit(F&& f) -> std::future<void>
+    {
+        auto task {std::packaged_task<void()> {std::forward<F>(f)}};
+        auto future {task.get_future()};
+
+        {
+            const auto lock {std::lock_guard {mutex}};
+            tasks.push_back(std::move(task));
+        }
+        cv.notify_one();
+        return future;
+    }
+
+    /* Submits a task that runs in elevator order with the others submitted
+     * with a key, before any without: the one with the lowest key at or after
+     * that of the last one run, or else the lowest. */
+    template <typename F>
+    [[nodiscard]] auto submit(F&& f, std::uint64_t key) -> std::future<void>
+    {
+        auto task {std::packaged_task<void()> {std::forward<F>(f)}};
+        auto future {task.get_future()};
+
+        {
+            const auto lock {std::lock_guard {mutex}};
+            keyed_tasks.emplace(key, std::move(task));
+        }
+        cv.notify_one();
+        return future;
+    }
+
+    /* Submits a task that works on the memory at address, to be run by a
+     * worker on the NUMA node of that memory if one is free. */
+    template <typename F>
+    [[nodiscard]] auto submit_near(F&& f, const void* address)
+        -> std::future<void> 
+    {
+        if (nodes.empty()) {
+            return submit(std::forward<F>(f));
+        }
+
+        const int id {page_node(address)};
+        const auto node {std::ranges::find(nodes, id, &NumaNode::id)};
+
+        if (node == nodes.end()) {
+            return submit(std::forward<F>(f));
+        }
+
+        auto task {std::packaged_task<void()> {std::forward<F>(f)}};
+        auto future {task.get_future()};
+
+        {
+            const auto lock {std::lock_guard {mutex}};
+            node_tasks[static_cast<std::size_t>(node - nodes.begin())]
+                .push_back(std::move(task));
+        }
+        cv.notify_one();
+        return future;
+    }
+
+    auto wait(std::future<void>& future) -> void
+    {
+        while (not limited and
+               future.wait_for(std::chrono::seconds {0}) !=
+                   std::future_status::ready and
+               run_one()) {
+        }
+        future.get();
+    }
+
+private:
+    /* The node of a thread that is not a worker, or of any worker when there
+     * is only one node. */
+    static constexpr std::size_t no_node {SIZE_MAX};
+
+    [[nodiscard]] auto empty() const -> bool
+    {
+        return tasks.empty() and keyed_tasks.empty() and
+               std::ranges::all_of(node_tasks, &std::deque<std::packaged_task<
+                                                   void()>>::empty);
+    }
+
+    /* Takes the next task for a thread on node, with the mutex locked and a
+     * task to take: one submitted near that node's memory, or else any, so
+     * that no worker idles while there are tasks. */
+    [[nodiscard]] auto take(std::size_t node) -> std::packaged_task<void()>
+    {
+        if (node != no_node and not node_tasks[node].empty()) {
+            return take(node_tasks[node]);
+        }
+
+        if (not keyed_tasks.empty()) {
+            auto next {keyed_tasks.lower_bound(position)};
+
+            if (next == keyed_tasks.end()) {
+                next = keyed_tasks.begin();
+            }
+
+            position = next->first;
+            return std::move(keyed_tasks.extract(next).mapped());
+        }
+
+        if (not tasks.empty()) {
+            return take(tasks);
+        }
+        return take(*std::ranges::find_if_not(
+            node_tasks, &std::deque<std::packaged_task<void()>>::empty));
+    }
+
+    [[nodiscard]] static auto take(std::deque<std::packaged_task<void()>>& queue)
+        -> std::packaged_task<void()> 
+    {
+        auto task {std::move(queue.front())};
+
+        queue.pop_front();
+        return task;
+    }
+
+    auto run_one() -> bool
+    {
+        auto lock {std::unique_lock {mutex}};
+
+        if (empty()) {
+            return false;
+        }
+
+        auto task {take(no_node)};
+
+        lock.unlock();
+        task();
+        return true;
+    }
+
+    auto work(std::size_t node) -> void
+    {
+        if (node != no_node) {
+            ::sched_setaffinity(0, sizeof nodes[node].cpus, &nodes[node].cpus);
+        }
+
+        while (true) {
+            auto lock {std::unique_lock {mutex}};
+
+            cv.wait(lock, [this] { return stopping or not empty(); });
+
+            if (empty()) {
+                return;
+            }
+
+            auto task {take(node)};
+
+            lock.unlock();
+            task();
+        }
+    }
+
+    bool limited {false};
+    std::mutex mutex {};
+    std::condition_variable cv {};
+    std::deque<std::packaged_task<void()>> tasks {};
+    std::multimap<std::uint64_t, std::packaged_task<void()>> keyed_tasks {};
+    std::uint64_t position {0}; /* The key of the last keyed task taken. */
+    std::vector<NumaNode> nodes {numa_nodes()};
+    std::vector<std::deque<std::packaged_task<void()>>> node_tasks {
+        nodes.size()};
+    bool stopping {false};
+    std::vector<std::thread> workers {};
+};
+
+/* The compression formats of --decompress, told by their magic bytes. */
+enum class Compression {
+    none,
+    gzip,
+    xz,
+    zstd
+};
+
+[[nodiscard]] static auto detect_compression(std::span<const char> data)
+    -> Compression 
+{
+    const auto starts_with {[data](std::string_view magic) {
+        return data.size() >= magic.size() and
+               std::memcmp(data.data(), magic.data(), magic.size()) == 0;
+    }};
+
+    if (starts_with("\x1f\x8b")) {
+        return Compression::gzip;
+    }
+
+    if (starts_with({"\xfd" "7zXZ\0", 6})) {
+        return Compression::xz;
+    }
+
+    if (starts_with("\x28\xb5\x2f\xfd")) {
+        return Compression::zstd;
+    }
+    return Compression::none;
+}
+
+/* Returns file without the extension of a compression format, so that --sloc
+ * finds the language of the decompressed content. */
+[[nodiscard]] static auto decompressed_name(std::string_view file)
+    -> std::string_view 
+{
+    for (const std::string_view extension : {".gz", ".xz", ".zst"}) {
+        if (file.ends_with(extension)) {
+            return file.substr(0, file.size() - extension.size());
+        }
+    }
+    return file;
+}
+
+/* Read buffers of one size, a multiple of 4 KiB, shared by all threads. They
+ * are cut from slabs of whole 2 MiB huge pages, from hugetlbfs if any are
+ * reserved or else marked for transparent huge pages, so that reading through
+ * them takes few TLB entries, and are aligned to 4 KiB for vector loads and
+ * O_DIRECT. Released buffers are kept in a fixed set of slots that threads
+ * fill and empty with atomic exchanges, so that they are reused without
+ * locking; only a thread that finds them all empty takes the mutex, to map
+ * another slab, or, if the memory budget has no room for one, to wait for a
+ * buffer to be released. */
+class BufferPool {
+    struct Release {
+        BufferPool* pool;
+
+        auto operator()(char* buffer) const -> void
+        {
+            pool->release(buffer);
+        }
+    };
+
+public:
+    /* A buffer of size() bytes, returned to the pool when destroyed, or null
+     * if no memory could be mapped. */
+    using Buffer = std::unique_ptr<char[], Release>;
+
+    BufferPool(std::size_t size, MemoryBudget& budget)
+        : buffer_size {(size + page_size - 1) / page_size * page_size},
+          budget {&budget}
+    {
+    }
+
+    BufferPool(const BufferPool&) = delete;
+    auto operator=(const BufferPool&) -> BufferPool& = delete;
+
+    ~BufferPool()
+    {
+        for (const auto slab : slabs) {
+            ::munmap(slab.data(), slab.size());
+            budget->give_back(slab.size());
+        }
+    }
+
+    [[nodiscard]] auto size() const -> std::size_t
+    {
+        return buffer_size;
+    }
+
+    [[nodiscard]] auto acquire() -> Buffer
+    {
+        return get(true);
+    }
+
+    /* Returns a buffer to a thread that holds others, which must not wait for
+     * the budget, as what it holds is not released meanwhile: the slab is
+     * mapped past the budget if need be. */
+    [[nodiscard]] auto acquire_more() -> Buffer
+    {
+        return get(false);
+    }
+
+private:
+    static constexpr std::size_t page_size {4096};
+    static constexpr std::size_t huge_page_size {std::size_t {1} << 21};
+
+    [[nodiscard]] auto get(bool wait) -> Buffer
+    {
+        while (true) {
+            if (auto* const buffer {take()}) {
+                return Buffer {buffer, Release {this}};
+            }
+
+            auto lock {std::unique_lock {mutex}};
+
+            /* A buffer released from now on is seen here, or else its release
+             * sees waiting and notifies, once the mutex is free. */
+            ++waiting;
+
+            if (auto* const buffer {take()}) {
+                --waiting;
+                return Buffer {buffer, Release {this}};
+            }
+
+            /* With no buffer out, none may be released: the slab is mapped
+             * past the budget. */
+            if (out == 0 or not wait) {
+                budget->take(slab_size());
+            } else if (not budget->try_take(slab_size())) {
+                cv.wait(lock);
+                --waiting;
+                continue;
+            }
+
+            --waiting;
+            lock.unlock();
+
+            auto* const buffer {grow()};
+
+            if (buffer) {
+                ++out;
+            }
+            return Buffer {buffer, Release {this}};
+        }
+    }
+
+    [[nodiscard]] auto slab_size() const -> std::size_t
+    {
+        return (buffer_size + huge_page_size - 1) / huge_page_size *
+               huge_page_size;
+    }
+
+    /* Takes a kept buffer, or returns null if there is none. */
+    [[nodiscard]] auto take() -> char*
+    {
+        for (auto& slot : slots) {
+            if (slot.load(std::memory_order_relaxed)) {
+                if (auto* const buffer {slot.exchange(nullptr)}) {
+                    ++out;
+                    return buffer;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    /* Keeps buffer for reuse, or drops it, to be unmapped with its slab, if
+     * every slot is taken. */
+    auto keep(char* buffer) -> void
+    {
+        for (auto& slot : slots) {
+            char* empty {nullptr};
+
+            if (slot.compare_exchange_strong(empty, buffer)) {
+                return;
+            }
+        }
+    }
+
+    auto release(char* buffer) -> void
+    {
+        keep(buffer);
+        --out;
+
+        if (waiting != 0) {
+            const auto lock {std::lock_guard {mutex}};
+            cv.notify_all();
+        }
+    }
+
+    /* Maps a slab, whose size has been taken from the budget, keeps all its
+     * buffers but one, and returns that one, or null if the slab cannot be
+     * mapped, with errno set. */
+    [[nodiscard]] auto grow() -> char*
+    {
+        const auto slab_size {this->slab_size()};
+        auto* slab {static_cast<char*>(::mmap(
+            nullptr, slab_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT),
+            -1, 0))};
+
+        if (slab == MAP_FAILED) {
+            /* Maps a huge page more than needed, and unmaps what lies outside
+             * the huge pages that the slab is aligned to. */
+            auto* const map {static_cast<char*>(::mmap(
+                nullptr, slab_size + huge_page_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))};
+
+            if (map == MAP_FAILED) {
+                budget->give_back(slab_size);
+                return nullptr;
+            }
+
+            const auto skip {(huge_page_size -
+                              reinterpret_cast<std::uintptr_t>(map) %
+                                  huge_page_size) %
+                             huge_page_size};
+
+            slab = map + skip;
+
+            if (skip != 0) {
+                ::munmap(map, skip);
+            }
+            ::munmap(slab + slab_size, huge_page_size - skip);
+            static_cast<void>(::madvise(slab, slab_size, MADV_HUGEPAGE));
+        }
+
+        {
+            const auto lock {std::lock_guard {mutex}};
+            slabs.emplace_back(slab, slab_size);
+        }
+
+        for (auto offset {buffer_size}; offset + buffer_size <= slab_size;
+             offset += buffer_size) {
+            keep(slab + offset);
+        }
+        return slab;
+    }
+
+    std::size_t buffer_size;
+    MemoryBudget* budget;
+    std::array<std::atomic<char*>, 64> slots {};
+    std::atomic<std::size_t> out {0}; /* The buffers not released. */
+    std::atomic<std::size_t> waiting {0}; /* The threads waiting for one. */
+    std::mutex mutex {};
+    std::condition_variable cv {};
+    std::vector<std::span<char>> slabs {};
+};
+
+/* A ring of buffers that a producer thread fills and a consumer thread takes
+ * in order, each waiting for the other when the ring is full or empty. The
+ * buffers are taken from pool, by a thread that holds others, and only their
+ * first buffer_size bytes are used. */
+class BufferRing {
+public:
+    BufferRing(std::size_t nbuffers, BufferPool& pool, std::size_t buffer_size)
+        : sizes(nbuffers),
+          buffer_size {buffer_size}
+    {
+        for (std::size_t i {0}; i < nbuffers; ++i) {
+            buffers.push_back(pool.acquire_more());
+        }
+    }
+
+    /* Whether all the buffers could be mapped. */
+    [[nodiscard]] auto allocated() const -> bool
+    {
+        return std::ranges::all_of(
+            buffers, [](const BufferPool::Buffer& buffer) { return bool(buffer); });
+    }
+
+    /* Returns the next buffer to fill, or an empty one if the consumer has
+     * stopped. */
+    [[nodiscard]] auto fill() -> std::span<char>
+    {
+        auto lock {std::unique_lock {mutex}};
+
+        released.wait(lock, [this] {
+            return produced - consumed < buffers.size() or stopped;
+        });
+
+        if (stopped) {
+            return {};
+        }
+        return {buffers[produced % buffers.size()].get(), buffer_size};
+    }
+
+    /* Passes the buffer returned by fill(), with its first size bytes filled,
+     * to the consumer. */
+    auto commit(std::size_t size) -> void
+    {
+        const auto lock {std::lock_guard {mutex}};
+
+        sizes[produced % buffers.size()] = size;
+        ++produced;
+        filled.notify_one();
+    }
+
+    /* Ends the buffers, on an errno value if error is not 0. */
+    auto close(int error) -> void
+    {
+        const auto lock {std::lock_guard {mutex}};
+
+        closed = true;
+        close_error = error;
+        filled.notify_one();
+    }
+
+    /* Returns the next filled buffer, to be released when done with, or
+     * nullopt after the last one. */
+    [[nodiscard]] auto next() -> std::optional<std::span<const char>>
+    {
+        auto lock {std::unique_lock {mutex}};
+
+        filled.wait(lock, [this] { return consumed < produced or closed; });
+
+        if (consumed == produced) {
+            return std::nullopt;
+        }
+
+        const auto i {consumed % buffers.size()};
+
+        return std::span<const char> {buffers[i].get(), sizes[i]};
+    }
+
+    auto release() -> void
+    {
+        const auto lock {std::lock_guard {mutex}};
+
+        ++consumed;
+        released.notify_one();
+    }
+
+    /* Stops the producer. */
+    auto stop() -> void
+    {
+        const auto lock {std::lock_guard {mutex}};
+
+        stopped = true;
+        released.notify_one();
+    }
+
+    [[nodiscard]] auto error() -> int
+    {
+        const auto lock {std::lock_guard {mutex}};
+
+        return close_error;
+    }
+
+private:
+    std::vector<BufferPool::Buffer> buffers {};
+    std::vector<std::size_t> sizes;
+    std::size_t buffer_size;
+    std::size_t produced {0};
+    std::size_t consumed {0};
+    bool closed {false};
+    bool stopped {false};
+    int close_error {0};
+    std::mutex mutex {};
+    std::condition_variable filled {};
+    std::condition_variable released {};
+};
+
+/* The decoders below decompress input, and then what read() returns until it
+ * returns an empty span or an errno value, into the buffers of output, which
+ * has the fill() and commit() of a BufferRing and stops them when fill()
+ * returns an empty buffer. They return 0 or an errno value. */
+
+/* Concatenated members are decompressed as one, as by gzip -d, and bytes
+ * after the last member are ignored if they do not start another. */
+template <typename Read, typename Output>
+[[nodiscard]] static auto inflate_gzip(std::span<const char> input,
+                                       Read&& read,
+                                       Output& output) -> int 
+{
+    auto stream {::z_stream {}};
+
+    if (::inflateInit2(&stream, 15 + 16) != Z_OK) {
+        return ENOMEM;
+    }
+
+    const auto end {[&stream](int error) {
+        ::inflateEnd(&stream);
+        return error;
+    }};
+    auto out {output.fill()};
+    bool between_members {false};
+    bool trailing {false};
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    stream.avail_in = static_cast<uInt>(input.size());
+    stream.next_out = reinterpret_cast<Bytef*>(out.data());
+    stream.avail_out = static_cast<uInt>(out.size());
+
+    while (not out.empty()) {
+        if (stream.avail_in == 0) {
+            const auto next {read()};
+
+            if (not next or next->empty()) {
+                output.commit(out.size() - stream.avail_out);
+                return end(not next ? next.error() : between_members ? 0 : EBADMSG);
+            }
+
+            stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(next->data()));
+            stream.avail_in = static_cast<uInt>(next->size());
+        }
+
+        if (trailing) {
+            stream.avail_in = 0;
+            continue;
+        }
+
+        if (between_members) {
+            if (*stream.next_in != 0x1f) {
+                trailing = true;
+                continue;
+            }
+
+            ::inflateReset(&stream);
+            between_members = false;
+        }
+
+        const int status {::inflate(&stream, Z_NO_FLUSH)};
+
+        if (status == Z_STREAM_END) {
+            between_members = true;
+        } else if (status != Z_OK and status != Z_BUF_ERROR) {
+            return end(EBADMSG);
+        }
+
+        if (stream.avail_out == 0) {
+            output.commit(out.size());
+            out = output.fill();
+            stream.next_out = reinterpret_cast<Bytef*>(out.data());
+            stream.avail_out = static_cast<uInt>(out.size());
+        }
+    }
+    return end(0);
+}
+
+/* Inflates raw deflate data, as zip archives store it. Unlike the decoders
+ * above, it has all of its input at once. */
+template <typename Output>
+[[nodiscard]] static auto inflate_raw(std::span<const char> input, Output& output)
+    -> int 
+{
+    auto stream {::z_stream {}};
+
+    if (::inflateInit2(&stream, -15) != Z_OK) {
+        return ENOMEM;
+    }
+
+    const auto end {[&stream](int error) {
+        ::inflateEnd(&stream);
+        return error;
+    }};
+    auto out {output.fill()};
+
+    stream.next_out = reinterpret_cast<Bytef*>(out.data());
+    stream.avail_out = static_cast<uInt>(out.size());
+
+    while (not out.empty()) {
+        if (stream.avail_in == 0) {
+            const auto n {std::min<std::size_t>(input.size(), UINT_MAX)};
+
+            stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+            stream.avail_in = static_cast<uInt>(n);
+            input = input.subspan(n);
+        }
+
+        const int status {::inflate(&stream, Z_NO_FLUSH)};
+
+        if (status == Z_STREAM_END) {
+            output.commit(out.size() - stream.avail_out);
+            return end(0);
+        }
+
+        if ((status != Z_OK and status != Z_BUF_ERROR) or
+            (stream.avail_out != 0 and stream.avail_in == 0 and input.empty())) {
+            return end(EBADMSG);
+        }
+
+        if (stream.avail_out == 0) {
+            output.commit(out.size());
+            out = output.fill();
+            stream.next_out = reinterpret_cast<Bytef*>(out.data());
+            stream.avail_out = static_cast<uInt>(out.size());
+        }
+    }
+    return end(0);
+}
+
+template <typename Read, typename Output>
+[[nodiscard]] static auto decode_xz(std::span<const char> input,
+                                    Read&& read,
+                                    Output& output) -> int 
+{
+    auto stream {::lzma_stream {}};
+
+    if (::lzma_stream_decoder(&stream, UINT64_MAX, LZMA_CONCATENATED) !=
+        LZMA_OK) {
+        return ENOMEM;
+    }
+
+    const auto end {[&stream](int error) {
+        ::lzma_end(&stream);
+        return error;
+    }};
+    auto out {output.fill()};
+    auto action {LZMA_RUN};
+
+    stream.next_in = reinterpret_cast<const std::uint8_t*>(input.data());
+    stream.avail_in = input.size();
+    stream.next_out = reinterpret_cast<std::uint8_t*>(out.data());
+    stream.avail_out = out.size();
+
+    while (not out.empty()) {
+        if (stream.avail_in == 0 and action == LZMA_RUN) {
+            const auto next {read()};
+
+            if (not next) {
+                return end(next.error());
+            }
+
+            stream.next_in = reinterpret_cast<const std::uint8_t*>(next->data());
+            stream.avail_in = next->size();
+            action = next->empty() ? LZMA_FINISH : LZMA_RUN;
+        }
+
+        const auto status {::lzma_code(&stream, action)};
+
+        if (status == LZMA_STREAM_END) {
+            output.commit(out.size() - stream.avail_out);
+            return end(0);
+        }
+
+        if (status != LZMA_OK) {
+            return end(status == LZMA_MEM_ERROR ? ENOMEM : EBADMSG);
+        }
+
+        if (stream.avail_out == 0) {
+            output.commit(out.size());
+            out = output.fill();
+            stream.next_out = reinterpret_cast<std::uint8_t*>(out.data());
+            stream.avail_out = out.size();
+        }
+    }
+    return end(0);
+}
+
+#if defined(WITH_ZSTD)
+template <typename Read, typename Output>
+[[nodiscard]] static auto decode_zstd(std::span<const char> input,
+                                      Read&& read,
+                                      Output& output) -> int 
+{
+    auto* const stream {::ZSTD_createDStream()};
+
+    if (not stream) {
+        return ENOMEM;
+    }
+
+    const auto end {[stream](int error) {
+        ::ZSTD_freeDStream(stream);
+        return error;
+    }};
+    auto out {output.fill()};
+    auto in_buffer {::ZSTD_inBuffer {input.data(), input.size(), 0}};
+    auto out_buffer {::ZSTD_outBuffer {out.data(), out.size(), 0}};
+    /* 0 when the last frame is complete. */
+    std::size_t frame_left {1};
+
+    while (not out.empty()) {
+        bool at_end {false};
+
+        if (in_buffer.pos == in_buffer.size) {
+            const auto next {read()};
+
+            if (not next) {
+                return end(next.error());
+            }
+
+            at_end = next->empty();
+            in_buffer = {next->data(), next->size(), 0};
+        }
+
+        /* At the end of the input, this flushes the decoder. */
+        const auto before {out_buffer.pos};
+        const auto hint {
+            ::ZSTD_decompressStream(stream, &out_buffer, &in_buffer)};
+
+        if (::ZSTD_isError(hint)) {
+            return end(EBADMSG);
+        }
+
+        if (at_end and out_buffer.pos == before) {
+            output.commit(out_buffer.pos);
+            return end(frame_left == 0 ? 0 : EBADMSG);
+        }
+
+        frame_left = hint;
+
+        if (out_buffer.pos == out_buffer.size) {
+            output.commit(out_buffer.pos);
+            out = output.fill();
+            out_buffer = {out.data(), out.size(), 0};
+        }
+    }
+    return end(0);
+}
+#else
+template <typename Read, typename Output>
+[[nodiscard]] static auto decode_zstd(std::span<const char>, Read&&, Output&)
+    -> int 
+{
+    return ENOTSUP;
+}
+#endif
+
+/* Reads a file descriptor on a thread of its own, size bytes at a time, and
+ * decompresses it into a ring of buffers of size bytes, or copies it if it is
+ * not compressed. Its buffers are taken from pool. */
+class Decompressor {
+public:
+    Decompressor(int fd, BufferPool& pool, std::size_t size)
+        : fd {fd},
+          size {std::min(size, pool.size())},
+          in {pool.acquire()},
+          ring {4, pool, this->size}
+    {
+        thread = std::thread {[this] { ring.close(run()); }};
+    }
+
+    Decompressor(const Decompressor&) = delete;
+    Decompressor(Decompressor&&) = delete;
+    auto operator=(const Decompressor&) -> Decompressor& = delete;
+    auto operator=(Decompressor&&) -> Decompressor& = delete;
+
+    ~Decompressor()
+    {
+        ring.stop();
+        thread.join();
+    }
+
+    [[nodiscard]] auto next() -> std::optional<std::span<const char>>
+    {
+        return ring.next();
+    }
+
+    auto release() -> void
+    {
+        ring.release();
+    }
+
+    /* Returns 0, or the errno value of the failure, once next() has returned
+     * nullopt. */
+    [[nodiscard]] auto error() -> int
+    {
+        return ring.error();
+    }
+
+    /* Returns the number of bytes read, once next() has returned nullopt. */
+    [[nodiscard]] auto compressed() const -> std::uintmax_t
+    {
+        return compressed_bytes;
+    }
+
+private:
+    /* The longest magic number of the formats, which detect_compression()
+     * needs whole. */
+    static constexpr std::size_t magic_size {6};
+
+    /* Reads the next input into in, from offset, and returns its size, 0 at
+     * the end of the file, or -1 on error. */
+    [[nodiscard]] auto read_input(std::size_t offset) -> ::ssize_t
+    {
+        ::ssize_t n {0};
+
+        do {
+            n = ::read(fd, in.get() + offset, size - offset);
+        } while (n == -1 and errno == EINTR);
+
+        if (n > 0) {
+            compressed_bytes += static_cast<std::uintmax_t>(n);
+        }
+        return n;
+    }
+
+    /* Returns 0 or an errno value. */
+    [[nodiscard]] auto run() -> int
+    {
+        if (not in or not ring.allocated()) {
+            return ENOMEM;
+        }
+
+        std::size_t filled {0};
+
+        /* Pipes can return less than the magic number of the format. */
+        while (filled < magic_size) {
+            const auto n {read_input(filled)};
+
+            if (n == -1) {
+                return errno;
+            }
+
+            if (n == 0) {
+                break;
+            }
+            filled += static_cast<std::size_t>(n);
+        }
+
+        if (filled == 0) {
+            return 0;
+        }
+
+        const auto input {std::span<const char> {in.get(), filled}};
+        const auto read {[this]() -> std::expected<std::span<const char>, int> {
+            const auto size {read_input(0)};
+
+            if (size == -1) {
+                return std::unexpected {errno};
+            }
+            return std::span<const char> {in.get(), static_cast<std::size_t>(size)};
+        }};
+
+        switch (detect_compression(input)) {
+        case Compression::gzip:
+            return inflate_gzip(input, read, ring);
+
+        case Compression::xz:
+            return decode_xz(input, read, ring);
+
+        case Compression::zstd:
+            return decode_zstd(input, read, ring);
+
+        case Compression::none:
+            break;
+        }
+        return copy(input);
+    }
+
+    [[nodiscard]] auto copy(std::span<const char> input) -> int
+    {
+        while (not input.empty()) {
+            const auto out {ring.fill()};
+
+            if (out.empty()) {
+                return 0;
+            }
+
+            std::ranges::copy(input, out.begin());
+            ring.commit(input.size());
+
+            const auto n {read_input(0)};
+
+            if (n == -1) {
+                return errno;
+            }
+            input = {in.get(), static_cast<std::size_t>(n)};
+        }
+        return 0;
+    }
+
+    int fd;
+    std::size_t size;
+    std::uintmax_t compressed_bytes {0};
+    BufferPool::Buffer in;
+    BufferRing ring;
+    std::thread thread {};
+};
+
+/* Chooses the size of reads from each device, and of the chunks that files
+ * are split into for -j, from the throughput measured so far.
+ *
+ * Reads start at 256 KiB. After every few MiB read from a device, the size of
+ * its reads is doubled or halved, between 64 KiB and the size of the buffers:
+ * in the same direction as the last time if the throughput of reading and
+ * counting rose, and in the other if it fell. The size thus climbs to the
+ * best one for the device and then keeps probing around it, following the
+ * device if it slows down.
+ *
+ * Chunks are sized to take about a millisecond to count, at the average
+ * counting throughput, between 64 KiB and 16 MiB: large enough that they
+ * cost little to schedule, and small enough to balance across threads. */
+class SizeTuner {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr std::size_t min_size {std::size_t {1} << 16};
+    static constexpr std::size_t max_size {std::size_t {1} << 24};
+
+    /* Reads fixed_size bytes at a time if it is not 0, and else at most
+     * buffer_size. */
+    SizeTuner(std::size_t fixed_size, std::size_t buffer_size)
+        : fixed_size {fixed_size},
+          buffer_size {buffer_size}
+    {
+    }
+
+    [[nodiscard]] auto read_size(dev_t device) -> std::size_t
+    {
+        if (fixed_size != 0) {
+            return fixed_size;
+        }
+
+        const auto lock {std::lock_guard {mutex}};
+        return tuning(device).size;
+    }
+
+    /* Records a read of bytes from device into a buffer of size bytes, from
+     * start, which took until read, and their counting, which has just
+     * ended. */
+    auto record(dev_t device,
+                std::size_t size,
+                std::size_t bytes,
+                Clock::time_point start,
+                Clock::time_point read) -> void
+    {
+        const auto end {Clock::now()};
+        const auto lock {std::lock_guard {mutex}};
+
+        add_count(bytes, end - read);
+
+        if (fixed_size != 0) {
+            return;
+        }
+
+        auto& tuned {tuning(device)};
+
+        /* The read was sized before the last change. */
+        if (size != tuned.size) {
+            return;
+        }
+
+        tuned.bytes += bytes;
+        tuned.time += end - start;
+
+        if (tuned.bytes < std::max(8 * tuned.size, window_size)) {
+            return;
+        }
+
+        const auto rate {rate_of(tuned.bytes, tuned.time)};
+
+        if (rate < tuned.rate) {
+            tuned.growing = not tuned.growing;
+        }
+
+        if (tuned.growing ? tuned.size * 2 > buffer_size
+                          : tuned.size / 2 < min_size) {
+            tuned.growing = not tuned.growing;
+        }
+
+        tuned.size = tuned.growing ? tuned.size * 2 : tuned.size / 2;
+        tuned.rate = rate;
+        tuned.bytes = 0;
+        tuned.time = {};
+    }
+
+    /* Records the counting of bytes of a chunk, which took time. */
+    auto record_count(std::size_t bytes, Clock::duration time) -> void
+    {
+        const auto lock {std::lock_guard {mutex}};
+        add_count(bytes, time);
+    }
+
+    [[nodiscard]] auto chunk_size() -> std::size_t
+    {
+        const auto lock {std::lock_guard {mutex}};
+
+        if (count_rate == 0) {
+            return std::size_t {1} << 20;
+        }
+
+        /* In bytes per nanosecond, a million nanoseconds. */
+        const auto size {count_rate * 1e6};
+
+        return size >= static_cast<double>(max_size) ? max_size
+            : std::max(std::bit_floor(static_cast<std::size_t>(size)), min_size);
+    }
+
+private:
+    /* The least number of bytes over which a read size is measured. */
+    static constexpr std::size_t window_size {std::size_t {4} << 20};
+
+    struct Tuning {
+        std::size_t size {0};
+        bool growing {true};
+        double rate {0}; /* Of the last window, in bytes per nanosecond. */
+        std::size_t bytes {0};
+        Clock::duration time {};
+    };
+
+    [[nodiscard]] static auto rate_of(std::size_t bytes, Clock::duration time)
+        -> double 
+    {
+        const auto ns {std::chrono::duration_cast<std::chrono::nanoseconds>(
+            time).count()};
+
+        return static_cast<double>(bytes) /
+               static_cast<double>(std::max<decltype(ns)>(ns, 1));
+    }
+
+    /* With the mutex locked. */
+    [[nodiscard]] auto tuning(dev_t device) -> Tuning&
+    {
+        auto& tuned {devices[device]};
+
+        if (tuned.size == 0) {
+            tuned.size = std::clamp(std::size_t {1} << 18, min_size, buffer_size);
+        }
+        return tuned;
+    }
+
+    /* With the mutex locked: averages the counting throughput, exponentially
+     * weighted towards recent counts, which are all large enough to time. */
+    auto add_count(std::size_t bytes, Clock::duration time) -> void
+    {
+        if (bytes < min_size) {
+            return;
+        }
+
+        const auto rate {rate_of(bytes, time)};
+
+        count_rate = count_rate == 0 ? rate : 0.9 * count_rate + 0.1 * rate;
+    }
+
+    std::size_t fixed_size;
+    std::size_t buffer_size;
+    std::mutex mutex {};
+    std::map<dev_t, Tuning> devices {};
+    double count_rate {0}; /* In bytes per nanosecond, or 0 if unknown. */
+};
+
+[[nodiscard]] static auto wc(const Options& options, 
+                             std::istream& is,
+                             dev_t device,
+                             int language)
+    -> std::expected<FileStatistics, bool> 
+{
+    auto counter {make_counter(options, false, language)};
+    auto& tuner {*options.tuner};
+    const auto buffer {options.buffers->acquire()};
+
+    if (not buffer) {
+        return std::unexpected {false};
+    }
+
+    while (is) {
+        const auto size {tuner.read_size(device)};
+        const auto start {SizeTuner::Clock::now()};
+
+        is.read(buffer.get(), static_cast<std::streamsize>(size));
+        const auto count {static_cast<std::size_t>(is.gcount())};
+        const auto read {SizeTuner::Clock::now()};
+
+        if (count == 0) {
+            break;
+        }
+
+        feed(counter, options, std::span {buffer.get(), count});
+        tuner.record(device, size, count, start, read);
+    }
+
+    if (is.bad()) {
+        return std::unexpected {false};
+    }
+    return finish(counter);
+}
+
+/* Returns a Decompressor of fd, with buffers from the pool of options, read
+ * as the tuner reads the device of fd. */
+[[nodiscard]] static auto make_decompressor(const Options& options, int fd)
+    -> std::unique_ptr<Decompressor> 
+{
+    struct stat st {};
+    const auto device {::fstat(fd, &st) == 0 ? st.st_dev : dev_t {0}};
+
+    return std::make_unique<Decompressor>(fd, *options.buffers,
+                                          options.tuner->read_size(device));
+}
+
+[[nodiscard]] static auto wc_decompressed(const Options& options,
+                                          int fd,
+                                          int language)
+    -> std::expected<FileStatistics, bool> 
+{
+    auto counter {make_counter(options, false, language)};
+    auto decompressor {make_decompressor(options, fd)};
+
+    while (const auto data {decompressor->next()}) {
+        feed(counter, options, *data);
+        decompressor->release();
+    }
+
+    if (const int error {decompressor->error()}; error != 0) {
+        errno = error;
+        return std::unexpected {false};
+    }
+
+    auto stats {finish(counter)};
+
+    if (stats) {
+        stats->compressed_bytes = decompressor->compressed();
+    }
+    return stats;
+}
+
+/* Splitting a file into chunks smaller than this costs more than it saves. */
+constexpr std::size_t min_chunk_size {1 << 20};
+
+/* Counts a memory-mapped regular file in chunks on the thread pool. Every
+ * chunk but the first is counted from just after its first newline, so that
+ * the counting state at its start is known; the bytes up to and including
+ * that newline are counted when the chunks are merged, in order. */
+[[nodiscard]] static auto wc_parallel(const Options& options,
+                                      ThreadPool& pool,
+                                      int fd,
+                                      std::size_t size)
+    -> std::expected<FileStatistics, bool> 
+{
+    void* const map {::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)};
+
+    if (map == MAP_FAILED) {
+        return std::unexpected {false};
+    }
+
+    const auto data {std::span {static_cast<const char*>(map), size}};
+    const auto nchunks {std::clamp(size / options.tuner->chunk_size(),
+                                   std::size_t {1}, pool.size() * 4)};
+    const auto chunk_size {size / nchunks};
+
+    struct Chunk {
+        std::span<const char> head {};
+        std::span<const char> body {};
+        Counter counter {};
+        std::future<void> done {};
+    };
+
+    auto chunks {std::vector<Chunk>(nchunks)};
+
+    auto counter {make_counter(options, false, -1)};
+
+    for (std::size_t i {0}; i < nchunks; ++i) {
+        const auto begin {i * chunk_size};
+        const auto end {i + 1 == nchunks ? size : begin + chunk_size};
+        const auto bytes {data.subspan(begin, end - begin)};
+        auto& chunk {chunks[i]};
+
+        if (i == 0) {
+            chunk.body = bytes;
+            chunk.counter = make_counter(options, &counter, false, -1);
+        } else {
+            const auto* const nl {static_cast<const char*>(
+                std::memchr(bytes.data(), '\n', bytes.size()))};
+            const auto head_size {
+                nl ? static_cast<std::size_t>(nl - bytes.data()) + 1
+                   : bytes.size()};
+
+            chunk.head = bytes.first(head_size);
+            chunk.body = bytes.subspan(head_size);
+            chunk.counter = make_counter(options, &counter, true, -1);
+        }
+    }
+
+    auto xxh3 {Xxh3 {}};
+    auto hashed {std::future<void> {}};
+
+    /* The CRC-32C register starts in the first chunk. XXH3 cannot be combined
+     * across chunks, so the whole file is hashed by one more task, submitted
+     * first as it is the longest. */
+    if (options.hash == HashAlgorithm::crc32c) {
+        counter.hash->crc = 0;
+    } else if (options.hash == HashAlgorithm::xxh3) {
+        counter.hash.reset();
+
+        for (auto& chunk : chunks) {
+            chunk.counter.hash.reset();
+        }
+        hashed = pool.submit([&xxh3, data] { xxh3.update(data); });
+    }
+
+    /* Each chunk is counted on the NUMA node that holds its first page. */
+    for (auto& chunk : chunks) {
+        chunk.done = pool.submit_near(
+            [&options, &chunk] {
+                const auto start {SizeTuner::Clock::now()};
+
+                feed(chunk.counter, options, chunk.body);
+                options.tuner->record_count(chunk.body.size(),
+                                            SizeTuner::Clock::now() - start);
+            },
+            chunk.body.data());
+    }
+
+    for (auto& chunk : chunks) {
+        pool.wait(chunk.done);
+        feed(counter, options, chunk.head);
+        merge(counter, chunk.counter);
+    }
+
+    auto stats {finish(counter)};
+
+    if (hashed.valid()) {
+        pool.wait(hashed);
+
+        if (stats) {
+            stats->hash = xxh3.digest();
+        }
+    }
+
+    ::munmap(map, size);
+    return stats;
+}
+
+/* A chunk of an input that is counted as it is read or decompressed, on the
+ * thread pool. As in wc_parallel, every chunk but the first is counted from
+ * just after its first newline, and the bytes before are kept in head to be
+ * counted when the chunks are merged. */
+struct StreamedChunk {
+    std::string head {};
+    bool in_head {false};
+    Counter counter {};
+    int error {0};
+    std::future<void> done {};
+
+    auto take(const Options& options, std::span<const char> bytes) -> void
+    {
+        if (in_head) {
+            const auto* const nl {static_cast<const char*>(
+                std::memchr(bytes.data(), '\n', bytes.size()))};
+            const auto head_size {
+                nl ? static_cast<std::size_t>(nl - bytes.data()) + 1
+                   : bytes.size()};
+
+            head.append(bytes.data(), head_size);
+            in_head = nl == nullptr;
+            bytes = bytes.subspan(head_size);
+        }
+        feed(counter, options, bytes);
+    }
+};
+
+/* Waits for the chunks, counted on pool unless it is null, and merges them in
+ * order. Inputs hashed with XXH3 must be in one chunk. */
+[[nodiscard]] static auto merge_chunks(const Options& options,
+                                       ThreadPool* pool,
+                                       std::span<StreamedChunk> chunks)
+    -> std::expected<FileStatistics, bool> 
+{
+    auto counter {make_counter(options, &chunks.front().counter, false, -1)};
+    int error {0};
+
+    /* The CRC-32C register starts in the first chunk. */
+    if (options.hash == HashAlgorithm::crc32c) {
+        counter.hash->crc = 0;
+    }
+
+    for (auto& chunk : chunks) {
+        if (chunk.done.valid()) {
+            pool->wait(chunk.done);
+        }
+
+        error = error != 0 ? error : chunk.error;
+        feed(counter, options, std::span {chunk.head});
+        merge(counter, chunk.counter);
+    }
+
+    if (options.hash == HashAlgorithm::xxh3) {
+        counter.hash = std::move(chunks.front().counter.hash);
+    }
+
+    if (error != 0) {
+        errno = error;
+        return std::unexpected {false};
+    }
+    return finish(counter);
+}
+
+/* Compressed data decompresses to a few times its size. */
+constexpr std::size_t min_compressed_chunk_size {min_chunk_size / 4};
+
+/* Returns the size of the BGZF block at the start of data, which its gzip
+ * header stores in a BC extra subfield, or 0 if it is not one. */
+[[nodiscard]] static auto bgzf_block_size(std::span<const char> data)
+    -> std::size_t 
+{
+    constexpr std::size_t header_size {12};
+    const auto* const bytes {reinterpret_cast<const unsigned char*>(data.data())};
+    const auto field {[&data](std::size_t i) -> std::size_t {
+        return load16(data.data() + i);
+    }};
+
+    if (data.size() < header_size or bytes[0] != 0x1f or bytes[1] != 0x8b or
+        bytes[2] != 8 or (bytes[3] & 4) == 0) {
+        return 0;
+    }
+
+    const auto extra_end {header_size + field(10)};
+
+    if (extra_end > data.size()) {
+        return 0;
+    }
+
+    for (auto i {header_size}; i + 4 <= extra_end; i += 4 + field(i + 2)) {
+        if (bytes[i] == 'B' and bytes[i + 1] == 'C' and field(i + 2) == 2 and
+            i + 6 <= extra_end) {
+            const auto size {field(i + 4) + 1};
+
+            return size <= data.size() ? size : 0;
+        }
+    }
+    return 0;
+}
+
+/* Returns the offsets of the independently compressed members that data is
+ * made of, BGZF blocks or zstd frames, or nothing if it is not. Plain gzip
+ * members do not record their size, so only inflating them finds where the
+ * next one starts. */
+[[nodiscard]] static auto compressed_members(std::span<const char> data,
+                                             Compression compression)
+    -> std::vector<std::size_t> 
+{
+    auto members {std::vector<std::size_t> {}};
+    std::size_t offset {0};
+
+    while (offset < data.size()) {
+        const auto rest {data.subspan(offset)};
+        std::size_t size {0};
+
+        if (compression == Compression::gzip) {
+            size = bgzf_block_size(rest);
+        }
+#if defined(WITH_ZSTD)
+        if (compression == Compression::zstd) {
+            size = ::ZSTD_findFrameCompressedSize(rest.data(), rest.size());
+            size = ::ZSTD_isError(size) ? 0 : size;
+        }
+#endif
+
+        if (size == 0) {
+            return {};
+        }
+
+        members.push_back(offset);
+        offset += size;
+    }
+    return members;
+}
+
+/* Counts a memory-mapped file made of independently compressed members, in
+ * chunks of whole members that are decompressed and counted on the thread
+ * pool. */
+[[nodiscard]] static auto wc_decompressed_parallel(
+    const Options& options,
+    ThreadPool& pool,
+    std::span<const char> data,
+    const std::vector<std::size_t>& members)
+    -> std::expected<FileStatistics, bool> 
+{
+    const auto nchunks {std::clamp(data.size() / min_compressed_chunk_size,
+                                   std::size_t {1}, pool.size() * 4)};
+    const auto chunk_size {data.size() / nchunks};
+    auto inputs {std::vector<std::span<const char>> {}};
+
+    for (auto member {members.begin()}; member != members.end();) {
+        const auto next {std::ranges::lower_bound(
+            member + 1, members.end(), *member + chunk_size)};
+        const auto end {next == members.end() ? data.size() : *next};
+
+        inputs.push_back(data.subspan(*member, end - *member));
+        member = next;
+    }
+
+    /* Takes the decompressed output of a chunk, in a buffer of the pool, a
+     * chunk size at a time. */
+    struct Output {
+        const Options& options;
+        StreamedChunk& chunk;
+        BufferPool::Buffer buffer {options.buffers->acquire()};
+        std::size_t size {std::min(options.buffers->size(),
+                                   options.tuner->chunk_size())};
+
+        [[nodiscard]] auto fill() -> std::span<char>
+        {
+            return {buffer.get(), size};
+        }
+
+        auto commit(std::size_t n) -> void
+        {
+            chunk.take(options, {buffer.get(), n});
+        }
+    };
+
+    auto chunks {std::vector<StreamedChunk>(inputs.size())};
+
+    for (std::size_t i {0}; i < chunks.size(); ++i) {
+        auto& chunk {chunks[i]};
+
+        chunk.in_head = i != 0;
+        chunk.counter = make_counter(
+            options, i == 0 ? nullptr : &chunks[0].counter, i != 0, -1);
+        chunk.done = pool.submit([&options, &chunk, input = inputs[i]] {
+            const auto end_of_input {
+                []() -> std::expected<std::span<const char>, int> {
+                    return std::span<const char> {};
+                }};
+            auto output {Output {options, chunk}};
+
+            chunk.error = not output.buffer ? errno
+                : detect_compression(input) == Compression::gzip
+                ? inflate_gzip(input, end_of_input, output)
+                : decode_zstd(input, end_of_input, output);
+        });
+    }
+
+    auto stats {merge_chunks(options, &pool, chunks)};
+
+    if (stats) {
+        stats->compressed_bytes = data.size();
+    }
+    return stats;
+}
+
+/* Counts a compressed file, on the thread pool if it is a regular file made
+ * of independently compressed members. XXH3 cannot be combined across chunks
+ * and the whole decompressed content is never in memory, so --hash=xxh3
+ * decompresses serially. */
+[[nodiscard]] static auto wc_compressed(const Options& options,
+                                        ThreadPool* pool,
+                                        int fd,
+                                        int language)
+    -> std::expected<FileStatistics, bool> 
+{
+    struct stat st {};
+
+    if (pool and not options.count_sloc and
+        options.hash != HashAlgorithm::xxh3 and ::fstat(fd, &st) == 0 and
+        S_ISREG(st.st_mode) and
+        static_cast<std::size_t>(st.st_size) >= 2 * min_compressed_chunk_size) {
+        const auto size {static_cast<std::size_t>(st.st_size)};
+        void* const map {::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)};
+
+        if (map != MAP_FAILED) {
+            const auto data {std::span {static_cast<const char*>(map), size}};
+            const auto members {
+                compressed_members(data, detect_compression(data))};
+
+            if (members.size() > 1) {
+                auto stats {wc_decompressed_parallel(options, *pool, data, members)};
+
+                ::munmap(map, size);
+                return stats;
+            }
+            ::munmap(map, size);
+        }
+    }
+    return wc_decompressed(options, fd, language);
+}
+
+/* Counts the size bytes of fd in chunks on the thread pool if there is one,
+ * each read with pread() into aligned buffers, so that reads can be O_DIRECT:
+ * data read once from disk gains nothing from the page cache but evicting
+ * what is there. */
+[[nodiscard]] static auto wc_direct(const Options& options,
+                                    ThreadPool* pool,
+                                    int fd,
+                                    std::uint64_t size,
+                                    dev_t device,
+                                    int language)
+    -> std::expected<FileStatistics, bool> 
+{
+    /* A multiple of the logical block size of any device, which the sizes of
+     * reads and the buffers of the pool also are. */
+    constexpr std::size_t alignment {4096};
+
+    if (const int flags {::fcntl(fd, F_GETFL)}; flags != -1) {
+        static_cast<void>(::fcntl(fd, F_SETFL, flags | O_DIRECT));
+    }
+
+    /* Block comments and strings can span lines, so --sloc is counted in one
+     * chunk, as is --hash=xxh3, which cannot be combined across chunks. */
+    const bool split {pool and not options.count_sloc and
+                      options.hash != HashAlgorithm::xxh3};
+    const auto nchunks {split
+        ? std::clamp<std::uint64_t>(size / options.tuner->chunk_size(), 1,
+                                    pool->size() * 4)
+        : 1};
+    const auto chunk_size {size / nchunks / alignment * alignment};
+    auto chunks {std::vector<StreamedChunk>(nchunks)};
+
+    const auto read_chunk {[&options, fd, device](StreamedChunk& chunk,
+                                                  std::uint64_t offset,
+                                                  std::uint64_t end) {
+        auto& tuner {*options.tuner};
+        const auto buffer {options.buffers->acquire()};
+
+        if (not buffer) {
+            chunk.error = errno;
+            return;
+        }
+
+        while (offset < end) {
+            /* Only the last chunk can end off alignment, at the end of the
+             * device, where reads come back short. */
+            const auto read_size {tuner.read_size(device)};
+            const auto length {std::min(
+                std::uint64_t {read_size},
+                (end - offset + alignment - 1) / alignment * alignment)};
+            const auto start {SizeTuner::Clock::now()};
+            const auto n {::pread(fd, buffer.get(), length,
+                                  static_cast<::off_t>(offset))};
+            const auto read {SizeTuner::Clock::now()};
+
+            if (n == -1 and errno == EINTR) {
+                continue;
+            }
+
+            /* Some devices and drivers refuse O_DIRECT reads. */
+            if (n == -1 and errno == EINVAL) {
+                if (const int flags {::fcntl(fd, F_GETFL)};
+                    flags != -1 and (flags & O_DIRECT) != 0 and
+                    ::fcntl(fd, F_SETFL, flags & ~O_DIRECT) == 0) {
+                    continue;
+                }
+            }
+
+            if (n <= 0) {
+                chunk.error = n == 0 ? 0 : errno;
+                return;
+            }
+
+            const auto bytes {std::min<std::uint64_t>(
+                static_cast<std::uint64_t>(n), end - offset)};
+
+            chunk.take(options, {buffer.get(), static_cast<std::size_t>(bytes)});
+            tuner.record(device, read_size, static_cast<std::size_t>(bytes),
+                         start, read);
+            offset += bytes;
+        }
+    }};
+
+    for (std::size_t i {0}; i < nchunks; ++i) {
+        auto& chunk {chunks[i]};
+        const auto begin {i * chunk_size};
+        const auto end {i + 1 == nchunks ? size : begin + chunk_size};
+
+        chunk.in_head = i != 0;
+        chunk.counter = make_counter(
+            options, i == 0 ? nullptr : &chunks[0].counter, i != 0, language);
+
+        if (nchunks == 1) {
+            read_chunk(chunk, begin, end);
+        } else {
+            chunk.done = pool->submit([&read_chunk, &chunk, begin, end] {
+                read_chunk(chunk, begin, end);
+            });
+        }
+    }
+    return merge_chunks(options, pool, chunks);
+}
+
+/* Counts a block device in chunks on the thread pool if there is one, each
+ * read with pread() into aligned buffers, so that reads can be O_DIRECT: a
+ * volume read once gains nothing from the page cache but evicting it. */
+[[nodiscard]] static auto wc_device(const Options& options,
+                                    ThreadPool* pool,
+                                    int fd,
+                                    dev_t device,
+                                    int language)
+    -> std::expected<FileStatistics, bool> 
+{
+    std::uint64_t size {0};
+
+    if (::ioctl(fd, BLKGETSIZE64, &size) == -1) {
+        return std::unexpected {false};
+    }
+    return wc_direct(options, pool, fd, size, device, language);
+}
+
+/* The cachestat() system call of Linux 6.5, which has the same number on all
+ * architectures, and its structures. */
+constexpr long sys_cachestat {451};
+
+struct CachestatRange {
+    std::uint64_t offset;
+    std::uint64_t length;
+};
+
+struct Cachestat {
+    std::uint64_t cache;
+    std::uint64_t dirty;
+    std::uint64_t writeback;
+    std::uint64_t evicted;
+    std::uint64_t recently_evicted;
+};
+
+/* Returns the fraction of the size bytes of fd that are in the page cache,
+ * from cachestat(), or else mincore() on a mapping of fd. */
+[[nodiscard]] static auto cached_fraction(int fd, std::size_t size) -> double 
+{
+    const auto page_size {static_cast<std::size_t>(::sysconf(_SC_PAGESIZE))};
+    const auto npages {(size + page_size - 1) / page_size};
+    auto range {CachestatRange {0, size}};
+    auto stat {Cachestat {}};
+
+    if (npages == 0) {
+        return 1.0;
+    }
+
+    if (::syscall(sys_cachestat, fd, &range, &stat, 0) == 0) {
+        return static_cast<double>(stat.cache) / static_cast<double>(npages);
+    }
+
+    void* const map {::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)};
+
+    if (map == MAP_FAILED) {
+        return 1.0;
+    }
+
+    auto pages {std::vector<unsigned char>(npages)};
+    std::size_t cached {0};
+
+    if (::mincore(map, size, pages.data()) == 0) {
+        cached = static_cast<std::size_t>(std::ranges::count_if(
+            pages, [](unsigned char page) { return (page & 1) != 0; }));
+    }
+
+    ::munmap(map, size);
+    return static_cast<double>(cached) / static_cast<double>(npages);
+}
+
+/* The number of files after the one being counted that are prefetched
+ * without -j, and the bytes of each. */
+constexpr std::size_t prefetch_files {4};
+constexpr ::off_t prefetch_size {16 << 20};
+
+/* Starts reading the start of the file at path into the page cache, without
+ * waiting for the reads to end. */
+static auto prefetch(const char* path) -> void 
+{
+    const int fd {::open(path, O_RDONLY | O_CLOEXEC)};
+
+    if (fd == -1) {
+        return;
+    }
+
+    static_cast<void>(::posix_fadvise(fd, 0, prefetch_size, POSIX_FADV_WILLNEED));
+    ::close(fd);
+}
+
+/* A file mostly not in the page cache, and so read from its device. */
+struct ColdFile {
+    dev_t device {0};
+    std::uint64_t offset {0}; /* Of its first extent on the device, or 0. */
+};
+
+/* Returns where the file at path is, if it is large enough for where it is
+ * read from to matter, and mostly not in the page cache. */
+[[nodiscard]] static auto find_cold(const char* path) -> std::optional<ColdFile> 
+{
+    const int fd {::open(path, O_RDONLY | O_CLOEXEC)};
+    struct stat st {};
+
+    if (fd == -1) {
+        return std::nullopt;
+    }
+
+    if (::fstat(fd, &st) == -1 or not S_ISREG(st.st_mode) or
+        static_cast<std::size_t>(st.st_size) < min_chunk_size or
+        cached_fraction(fd, static_cast<std::size_t>(st.st_size)) >= 0.5) {
+        ::close(fd);
+        return std::nullopt;
+    }
+
+    /* Room for one extent after the header. */
+    std::uint64_t buffer[(sizeof(::fiemap) + sizeof(::fiemap_extent)) /
+                         sizeof(std::uint64_t)] {};
+    auto* const map {reinterpret_cast<::fiemap*>(buffer)};
+    auto cold {ColdFile {st.st_dev, 0}};
+
+    map->fm_length = FIEMAP_MAX_OFFSET;
+    map->fm_extent_count = 1;
+
+    if (::ioctl(fd, FS_IOC_FIEMAP, map) == 0 and map->fm_mapped_extents == 1) {
+        cold.offset = map->fm_extents[0].fe_physical;
+    }
+
+    ::close(fd);
+    return cold;
+}
+
+/* The queue of a block device, as sysfs describes it. */
+struct DeviceQueue {
+    bool rotational {false};
+    unsigned requests {0}; /* The most requests it queues, or 0. */
+};
+
+/* Returns the queue of the block device that is, or holds the partition that
+ * is, device; or nullopt if it is not a block device, as for tmpfs. */
+[[nodiscard]] static auto find_device_queue(dev_t device)
+    -> std::optional<DeviceQueue> 
+{
+    const auto read_number {[](const std::string& path) -> std::optional<unsigned> {
+        auto is {std::ifstream {path}};
+        unsigned value {0};
+
+        if (not(is >> value)) {
+            return std::nullopt;
+        }
+        return value;
+    }};
+    const auto base {
+        std::format("/sys/dev/block/{}:{}", major(device), minor(device))};
+
+    /* Partitions have no queue of their own. */
+    for (const auto& queue : {base + "/queue", base + "/../queue"}) {
+        if (const auto rotational {read_number(queue + "/rotational")}) {
+            return DeviceQueue {*rotational != 0,
+                                read_number(queue + "/nr_requests").value_or(0)};
+        }
+    }
+    return std::nullopt;
+}
+
+/* Counts a character device or a FIFO with read() into one buffer. The pipe
+ * of a FIFO is grown first, so that its writer blocks less often; this fails
+ * harmlessly on anything else. */
+[[nodiscard]] static auto wc_stream(const Options& options,
+                                    int fd,
+                                    dev_t device,
+                                    int language)
+    -> std::expected<FileStatistics, bool> 
+{
+    constexpr int pipe_size {1 << 20};
+    auto counter {make_counter(options, false, language)};
+    auto& tuner {*options.tuner};
+    const auto buffer {options.buffers->acquire()};
+
+    if (not buffer) {
+        return std::unexpected {false};
+    }
+
+    static_cast<void>(::fcntl(fd, F_SETPIPE_SZ, pipe_size));
+
+    for (;;) {
+        const auto size {tuner.read_size(device)};
+        const auto start {SizeTuner::Clock::now()};
+        const auto n {::read(fd, buffer.get(), size)};
+        const auto read {SizeTuner::Clock::now()};
+
+        if (n == -1 and errno == EINTR) {
+            continue;
+        }
+
+        if (n == -1) {
+            return std::unexpected {false};
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        feed(counter, options, {buffer.get(), static_cast<std::size_t>(n)});
+        tuner.record(device, size, static_cast<std::size_t>(n), start, read);
+    }
+    return finish(counter);
+}
+
+static auto add_time_buckets(TimeBuckets& total, const TimeBuckets& buckets)
+    -> void 
+{
+    for (const auto& [start, counts] : buckets.buckets) {
+        total.buckets[start] += counts;
+    }
+    total.untimed += buckets.untimed;
+}
+
+/* Adds the counts of stats to total, and returns the name of the count that
+ * overflows if one does. */
+[[nodiscard]] static auto add_statistics(const Options& options,
+                                         FileStatistics& total,
+                                         const FileStatistics& stats)
+    -> std::expected<void, std::string_view> 
+{
+    total.max_line_length = std::max(stats.max_line_length, total.max_line_length);
+
+    if (stats.csv_records != 0) {
+        total.csv_min_fields = total.csv_records == 0
+            ? stats.csv_min_fields
+            : std::min(stats.csv_min_fields, total.csv_min_fields);
+        total.csv_max_fields = std::max(stats.csv_max_fields, total.csv_max_fields);
+    }
+
+    if (!chkd_add(total.lines, total.lines, stats.lines)) {
+        return std::unexpected {"lines"};
+    } else if (!chkd_add(total.words, total.words, stats.words)) {
+        return std::unexpected {"words"};
+    } else if (!chkd_add(total.bytes, total.bytes, stats.bytes)) {
+        return std::unexpected {"bytes"};
+    } else if (!chkd_add(total.csv_records, total.csv_records,
+                         stats.csv_records)) {
+        return std::unexpected {"records"};
+    }
+
+    total.jsonl_records += stats.jsonl_records;
+    total.jsonl_empty += stats.jsonl_empty;
+    total.jsonl_malformed += stats.jsonl_malformed;
+    total.sloc_code += stats.sloc_code;
+    total.sloc_comment += stats.sloc_comment;
+    total.sloc_blank += stats.sloc_blank;
+    total.tokens += stats.tokens;
+    total.compressed_bytes += stats.compressed_bytes;
+
+    if (stats.distinct) {
+        if (not total.distinct) {
+            total.distinct = std::make_shared<DistinctLines>(
+                options.distinct_memory, 0U, *options.budget);
+        }
+        total.distinct->merge(*stats.distinct);
+    }
+    return {};
+}
+
+/* Adds a counted member to the sums of its archive, and returns false if a
+ * count overflows. */
+[[nodiscard]] static auto add_archive_member(const Options& options,
+                                             FileStatistics& archive,
+                                             ArchiveMember member) -> bool 
+{
+    auto& stats {member.stats};
+    const bool added {add_statistics(options, archive, stats).has_value()};
+
+    if (stats.sketch) {
+        if (not archive.sketch) {
+            archive.sketch = std::make_shared<HyperLogLog>(options.hll_precision);
+        }
+        static_cast<void>(archive.sketch->merge(*stats.sketch));
+    }
+
+    if (stats.word_frequencies) {
+        if (not archive.word_frequencies) {
+            archive.word_frequencies = std::make_shared<WordFrequencies>(
+                options.top_words, options.top_words_sketch, *options.budget);
+        }
+        archive.word_frequencies->merge(*stats.word_frequencies);
+    }
+
+    if (stats.buckets) {
+        if (not archive.buckets) {
+            archive.buckets = std::make_shared<TimeBuckets>();
+        }
+        add_time_buckets(*archive.buckets, *stats.buckets);
+    }
+
+    /* Only the sums are printed of these. */
+    stats.distinct.reset();
+    stats.sketch.reset();
+    stats.word_frequencies.reset();
+    stats.buckets.reset();
+    archive.members->push_back(std::move(member));
+    return added;
+}
+
+/* Computes the counts of an archive that are not sums, once all its members
+ * are added. */
+static auto finish_archive(FileStatistics& archive) -> void 
+{
+    if (archive.distinct) {
+        archive.distinct_lines = archive.distinct->count();
+    }
+
+    if (archive.sketch) {
+        archive.approx_distinct = archive.sketch->estimate();
+    }
+}
+
+/* The size of tar headers, and the unit of the data of members. */
+constexpr std::size_t tar_block_size {512};
+
+/* Returns the value of a numeric field of a tar header, which is in octal, or
+ * in base 256 if its first byte has the high bit set, as GNU tar writes sizes
+ * of 8 GiB or more; or nullopt if the field is malformed. */
+[[nodiscard]] static auto tar_number(std::string_view field)
+    -> std::optional<std::uintmax_t> 
+{
+    std::uintmax_t value {0};
+
+    if (not field.empty() and (static_cast<unsigned char>(field[0]) & 0x80) != 0) {
+        value = static_cast<unsigned char>(field[0]) & 0x3fU;
+
+        for (const char c : field.substr(1)) {
+            if (value >> (std::numeric_limits<std::uintmax_t>::digits - 8) != 0) {
+                return std::nullopt;
+            }
+            value = value << 8 | static_cast<unsigned char>(c);
+        }
+        return value;
+    }
+
+    const auto begin {std::min(field.find_first_not_of(' '), field.size())};
+
+    for (const char c : field.substr(begin)) {
+        if (c == ' ' or c == '\0') {
+            break;
+        }
+
+        if (c < '0' or c > '7') {
+            return std::nullopt;
+        }
+        value = value * 8 + static_cast<std::uintmax_t>(c - '0');
+    }
+    return value;
+}
+
+struct TarHeader {
+    std::string name {};
+    char type {'0'};
+    std::uintmax_t size {0};
+};
+
+/* Returns the header in block, or nullopt if its checksum is wrong. */
+[[nodiscard]] static auto parse_tar_header(std::string_view block)
+    -> std::optional<TarHeader> 
+{
+    const auto field {[block](std::size_t offset, std::size_t size) {
+        const auto value {block.substr(offset, size)};
+
+        return value.substr(0, value.find('\0'));
+    }};
+    /* The checksum counts its own field as spaces. Old tars summed signed
+     * bytes. */
+    std::uintmax_t sum {8 * ' '};
+    std::intmax_t signed_sum {8 * ' '};
+
+    for (std::size_t i {0}; i < block.size(); ++i) {
+        if (i < 148 or i >= 156) {
+            sum += static_cast<unsigned char>(block[i]);
+            signed_sum += static_cast<signed char>(block[i]);
+        }
+    }
+
+    const auto checksum {tar_number(block.substr(148, 8))};
+    const auto size {tar_number(block.substr(124, 12))};
+
+    if (not checksum or not size or
+        (*checksum != sum and
+         *checksum != static_cast<std::uintmax_t>(signed_sum))) {
+        return std::nullopt;
+    }
+
+    auto header {TarHeader {std::string {field(0, 100)}, block[156], *size}};
+
+    if (block.substr(257, 5) == "ustar" and not field(345, 155).empty()) {
+        header.name = std::format("{}/{}", field(345, 155), header.name);
+    }
+    return header;
+}
+
+/* Returns the path record of the data of a pax extended header, if it has
+ * one. Records are "LENGTH KEY=VALUE\n", LENGTH counting the whole record. */
+[[nodiscard]] static auto pax_path(std::string_view records)
+    -> std::optional<std::string> 
+{
+    while (not records.empty()) {
+        const auto space {records.find(' ')};
+        const auto length {parse_unsigned(records.substr(0, space))};
+
+        if (space == std::string_view::npos or not length or
+            *length <= space or *length > records.size()) {
+            return std::nullopt;
+        }
+
+        const auto record {records.substr(space + 1, *length - space - 2)};
+
+        if (record.starts_with("path=")) {
+            return std::string {record.substr(5)};
+        }
+        records.remove_prefix(*length);
+    }
+    return std::nullopt;
+}
+
+/* Counts each regular member of a tar archive, which may be compressed, as it
+ * streams from fd, and returns the sums of the members with the counts of
+ * each. Headers are parsed as they come in the same loop, and the data of
+ * other entries and the padding of every entry are skipped. */
+[[nodiscard]] static auto wc_tar(const Options& options, int fd)
+    -> std::expected<FileStatistics, bool> 
+{
+    auto archive {FileStatistics {}};
+    auto decompressor {make_decompressor(options, fd)};
+    auto block {std::array<char, tar_block_size> {}};
+    std::size_t block_fill {0};
+    /* The member being counted, if the data being read is of one. */
+    auto member {std::optional<ArchiveMember> {}};
+    auto counter {Counter {}};
+    /* The data being read of a GNU long name or a pax header, if it is. */
+    std::string* extended {nullptr};
+    std::string long_name {};
+    std::string pax {};
+    std::uintmax_t data_left {0};
+    std::uintmax_t padding {0};
+    bool ended {false};
+    int error {0};
+
+    archive.members = std::make_shared<std::vector<ArchiveMember>>();
+
+    const auto end_member {[&] {
+        auto finished {finish(counter)};
+
+        if (not finished) {
+            error = errno;
+            return;
+        }
+
+        member->stats = std::move(finished.value());
+
+        if (not add_archive_member(options, archive, std::move(member.value()))) {
+            error = EOVERFLOW;
+        }
+        member.reset();
+    }};
+
+    const auto start_entry {[&](const TarHeader& header) {
+        data_left = header.size;
+        padding = (tar_block_size - header.size % tar_block_size) % tar_block_size;
+        extended = nullptr;
+
+        if (header.type == 'L') {
+            extended = &long_name;
+            long_name.clear();
+            return;
+        }
+
+        if (header.type == 'x') {
+            extended = &pax;
+            pax.clear();
+            return;
+        }
+
+        if (header.type == 'g') {
+            return;
+        }
+
+        auto name {pax_path(pax)};
+
+        if (not name and not long_name.empty()) {
+            name = long_name.substr(0, long_name.find('\0'));
+        }
+
+        if (header.type == '0' or header.type == '\0' or header.type == '7') {
+            member = ArchiveMember {name.value_or(header.name), {}};
+            counter = make_counter(options, false, find_language(member->name));
+
+            if (data_left == 0) {
+                end_member();
+            }
+        }
+        long_name.clear();
+        pax.clear();
+    }};
+
+    while (const auto data {decompressor->next()}) {
+        auto rest {*data};
+
+        while (not rest.empty() and not ended and error == 0) {
+            if (data_left != 0) {
+                const auto n {static_cast<std::size_t>(
+                    std::min<std::uintmax_t>(data_left, rest.size()))};
+
+                if (member) {
+                    feed(counter, options, rest.first(n));
+                } else if (extended) {
+                    extended->append(rest.data(), n);
+                }
+
+                data_left -= n;
+                rest = rest.subspan(n);
+
+                if (data_left == 0 and member) {
+                    end_member();
+                }
+            } else if (padding != 0) {
+                const auto n {static_cast<std::size_t>(
+                    std::min<std::uintmax_t>(padding, rest.size()))};
+
+                padding -= n;
+                rest = rest.subspan(n);
+            } else {
+                const auto n {std::min(tar_block_size - block_fill, rest.size())};
+
+                std::ranges::copy(rest.first(n), block.begin() + block_fill);
+                block_fill += n;
+                rest = rest.subspan(n);
+
+                if (block_fill < tar_block_size) {
+                    continue;
+                }
+
+                block_fill = 0;
+
+                const auto bytes {std::string_view {block.data(), block.size()}};
+
+                /* The archive ends with zero blocks. */
+                if (bytes.find_first_not_of('\0') == std::string_view::npos) {
+                    ended = true;
+                } else if (const auto header {parse_tar_header(bytes)}) {
+                    start_entry(*header);
+                } else {
+                    error = EBADMSG;
+                }
+            }
+        }
+
+        decompressor->release();
+
+        if (ended or error != 0) {
+            break;
+        }
+    }
+
+    if (error == 0) {
+        error = decompressor->error();
+    }
+
+    if (error == 0 and not ended and
+        (block_fill != 0 or data_left != 0 or padding != 0)) {
+        error = EBADMSG;
+    }
+
+    if (error != 0) {
+        errno = error;
+        return std::unexpected {false};
+    }
+
+    finish_archive(archive);
+
+    if (options.decompress) {
+        archive.compressed_bytes = decompressor->compressed();
+    }
+    return archive;
+}
+
+struct ZipEntry {
+    std::string_view name {};
+    std::uint16_t flags {0};
+    std::uint16_t method {0};
+    std::uint64_t compressed_size {0};
+    std::uint64_t size {0};
+    std::uint64_t offset {0}; /* Of the local header. */
+};
+
+/* Returns the entries of the central directory of the zip archive in data,
+ * or an errno value. Archives too large for 32-bit fields have a zip64 end of
+ * central directory record, and entries a zip64 extra field. */
+[[nodiscard]] static auto zip_entries(std::span<const char> data)
+    -> std::expected<std::vector<ZipEntry>, int> 
+{
+    constexpr std::size_t end_size {22};
+    constexpr std::size_t entry_size {46};
+    constexpr std::size_t max_comment {65535};
+
+    if (data.size() < end_size) {
+        return std::unexpected {EBADMSG};
+    }
+
+    /* The end of central directory record is followed by a comment. */
+    const auto lowest {data.size() - std::min(data.size(), end_size + max_comment)};
+    auto end {data.size() - end_size};
+
+    while (load32(data.data() + end) != 0x06054b50) {
+        if (end == lowest) {
+            return std::unexpected {EBADMSG};
+        }
+        --end;
+    }
+
+    const auto* p {data.data() + end};
+    std::uint64_t count {load16(p + 10)};
+    std::uint64_t directory_size {load32(p + 12)};
+    std::uint64_t directory_offset {load32(p + 16)};
+
+    if (end >= 20 and load32(p - 20) == 0x07064b50) {
+        const auto record {load64(p - 20 + 8)};
+
+        if (data.size() < 56 or record > data.size() - 56 or
+            load32(data.data() + record) != 0x06064b50) {
+            return std::unexpected {EBADMSG};
+        }
+
+        p = data.data() + record;
+        count = load64(p + 32);
+        directory_size = load64(p + 40);
+        directory_offset = load64(p + 48);
+    }
+
+    if (directory_offset > data.size() or
+        directory_size > data.size() - directory_offset) {
+        return std::unexpected {EBADMSG};
+    }
+
+    auto directory {data.subspan(directory_offset, directory_size)};
+    auto entries {std::vector<ZipEntry> {}};
+
+    entries.reserve(std::min(count, directory_size / entry_size));
+
+    for (std::uint64_t i {0}; i < count; ++i) {
+        p = directory.data();
+
+        if (directory.size() < entry_size or load32(p) != 0x02014b50) {
+            return std::unexpected {EBADMSG};
+        }
+
+        const std::size_t name_size {load16(p + 28)};
+        const std::size_t extra_size {load16(p + 30)};
+        const auto record_size {entry_size + name_size + extra_size + load16(p + 32)};
+
+        if (record_size > directory.size()) {
+            return std::unexpected {EBADMSG};
+        }
+
+        auto entry {ZipEntry {std::string_view {p + entry_size, name_size},
+                              load16(p + 8), load16(p + 10), load32(p + 20),
+                              load32(p + 24), load32(p + 42)}};
+        auto extra {directory.subspan(entry_size + name_size, extra_size)};
+
+        /* The zip64 extra field has the fields that are all ones, in this
+         * order. */
+        while (extra.size() >= 4) {
+            const std::size_t size {load16(extra.data() + 2)};
+
+            if (size > extra.size() - 4) {
+                break;
+            }
+
+            if (load16(extra.data()) == 1) {
+                auto field {extra.subspan(4, size)};
+
+                for (auto* const value :
+                     {&entry.size, &entry.compressed_size, &entry.offset}) {
+                    if (*value == 0xffffffff and field.size() >= 8) {
+                        *value = load64(field.data());
+                        field = field.subspan(8);
+                    }
+                }
+            }
+            extra = extra.subspan(4 + size);
+        }
+
+        entries.push_back(entry);
+        directory = directory.subspan(record_size);
+    }
+    return entries;
+}
+
+/* Returns the stored data of entry, which follows its local header, or
+ * nullopt if it is not in data. */
+[[nodiscard]] static auto zip_data(std::span<const char> data,
+                                   const ZipEntry& entry)
+    -> std::optional<std::span<const char>> 
+{
+    constexpr std::size_t header_size {30};
+
+    if (entry.offset > data.size() or data.size() - entry.offset < header_size or
+        load32(data.data() + entry.offset) != 0x04034b50) {
+        return std::nullopt;
+    }
+
+    const auto* const p {data.data() + entry.offset};
+    const auto start {entry.offset + header_size + load16(p + 26) + load16(p + 28)};
+
+    if (start > data.size() or entry.compressed_size > data.size() - start) {
+        return std::nullopt;
+    }
+    return data.subspan(start, entry.compressed_size);
+}
+
+/* Counts the files of the zip archive in data, on the thread pool if there is
+ * one, in batches of members of about min_compressed_chunk_size compressed
+ * bytes. Stored members are counted straight from data. */
+[[nodiscard]] static auto wc_zip(const Options& options,
+                                 ThreadPool* pool,
+                                 std::span<const char> data)
+    -> std::expected<FileStatistics, bool> 
+{
+    auto entries {zip_entries(data)};
+
+    if (not entries) {
+        errno = entries.error();
+        return std::unexpected {false};
+    }
+
+    std::erase_if(*entries, [](const ZipEntry& entry) {
+        return entry.name.ends_with('/');
+    });
+
+    struct Result {
+        std::expected<FileStatistics, bool> stats {};
+        int error {0};
+    };
+
+    /* Takes the inflated data of a member, in a buffer of the pool, a chunk
+     * size at a time. */
+    struct Output {
+        const Options& options;
+        Counter& counter;
+        BufferPool::Buffer buffer {options.buffers->acquire()};
+        std::size_t size {std::min(options.buffers->size(),
+                                   options.tuner->chunk_size())};
+
+        [[nodiscard]] auto fill() -> std::span<char>
+        {
+            return {buffer.get(), size};
+        }
+
+        auto commit(std::size_t n) -> void
+        {
+            feed(counter, options, std::span<const char> {buffer.get(), n});
+        }
+    };
+
+    const auto count_entry {[&options, data](const ZipEntry& entry,
+                                             Result& result) {
+        const auto bytes {zip_data(data, entry)};
+        auto counter {make_counter(options, false, find_language(entry.name))};
+
+        /* Bit 0 of the flags marks encrypted members. */
+        if (not bytes) {
+            result.error = EBADMSG;
+        } else if ((entry.flags & 1) != 0) {
+            result.error = ENOTSUP;
+        } else if (entry.method == 0) {
+            feed(counter, options, *bytes);
+        } else if (entry.method == 8) {
+            auto output {Output {options, counter}};
+
+            result.error = output.buffer ? inflate_raw(*bytes, output) : errno;
+        } else {
+            result.error = ENOTSUP;
+        }
+
+        if (result.error == 0 and counter.stats.bytes != entry.size) {
+            result.error = EBADMSG;
+        }
+
+        if (result.error == 0) {
+            result.stats = finish(counter);
+            result.error = result.stats ? 0 : errno;
+        }
+    }};
+
+    auto results {std::vector<Result>(entries->size())};
+
+    if (pool) {
+        auto batches {std::vector<std::future<void>> {}};
+
+        for (std::size_t begin {0}; begin < entries->size();) {
+            auto end {begin};
+
+            for (std::uint64_t batch_size {0};
+                 end < entries->size() and batch_size < min_compressed_chunk_size;
+                 ++end) {
+                batch_size += (*entries)[end].compressed_size;
+            }
+
+            batches.push_back(pool->submit([&, begin, end] {
+                for (auto i {begin}; i < end; ++i) {
+                    count_entry((*entries)[i], results[i]);
+                }
+            }));
+            begin = end;
+        }
+
+        for (auto& batch : batches) {
+            pool->wait(batch);
+        }
+    } else {
+        for (std::size_t i {0}; i < entries->size(); ++i) {
+            count_entry((*entries)[i], results[i]);
+        }
+    }
+
+    auto archive {FileStatistics {}};
+
+    archive.members = std::make_shared<std::vector<ArchiveMember>>();
+
+    for (std::size_t i {0}; i < entries->size(); ++i) {
+        auto& result {results[i]};
+
+        if (result.error != 0) {
+            errno = result.error;
+            return std::unexpected {false};
+        }
+
+        result.stats->compressed_bytes = (*entries)[i].compressed_size;
+
+        if (not add_archive_member(
+                options, archive,
+                {std::string {(*entries)[i].name}, std::move(*result.stats)})) {
+            errno = EOVERFLOW;
+            return std::unexpected {false};
+        }
+    }
+
+    finish_archive(archive);
+
+    if (options.decompress) {
+        archive.compressed_bytes = data.size();
+    }
+    return archive;
+}
+
+/* Maps the zip archive fd, which must be a regular file, as its central
+ * directory is at its end. */
+[[nodiscard]] static auto wc_zip(const Options& options, ThreadPool* pool, int fd)
+    -> std::expected<FileStatistics, bool> 
+{
+    struct stat st {};
+
+    if (::fstat(fd, &st) == -1) {
+        return std::unexpected {false};
+    }
+
+    if (not S_ISREG(st.st_mode) or st.st_size == 0) {
+        errno = S_ISREG(st.st_mode) ? EBADMSG : ESPIPE;
+        return std::unexpected {false};
+    }
+
+    const auto size {static_cast<std::size_t>(st.st_size)};
+    void* const map {::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)};
+
+    if (map == MAP_FAILED) {
+        return std::unexpected {false};
+    }
+
+    const auto stats {
+        wc_zip(options, pool, std::span {static_cast<const char*>(map), size})};
+    const int saved_errno {errno};
+
+    ::munmap(map, size);
+    errno = saved_errno;
+    return stats;
+}
+
+/* Counts file, reading it with O_DIRECT if it is a regular file that is cold,
+ * mostly not in the page cache. */
+[[nodiscard]] static auto wc_path(const Options& options,
+                                  ThreadPool* pool,
+                                  const char* file,
+                                  bool cold)
+    -> std::expected<FileStatistics, bool> 
+{
+    if (options.tar or options.zip) {
+        const int fd {::open(file, O_RDONLY | O_CLOEXEC)};
+
+        if (fd == -1) {
+            return std::unexpected {false};
+        }
+
+        const auto stats {options.tar ? wc_tar(options, fd)
+                                      : wc_zip(options, pool, fd)};
+        const int saved_errno {errno};
+
+        ::close(fd);
+        errno = saved_errno;
+        return stats;
+    }
+
+    if (options.decompress) {
+        const int fd {::open(file, O_RDONLY | O_CLOEXEC)};
+        char magic[6] {};
+
+        if (fd == -1) {
+            return std::unexpected {false};
+        }
+
+        const auto n {::pread(fd, magic, sizeof magic, 0)};
+
+        /* What cannot be read twice, as FIFOs, goes to the Decompressor,
+         * which tells the format from the bytes it reads, and copies them if
+         * they are not compressed. */
+        if ((n == -1 and errno == ESPIPE) or
+            (n > 0 and detect_compression({magic, static_cast<std::size_t>(n)}) !=
+                           Compression::none)) {
+            const auto stats {wc_compressed(
+                options, pool, fd, find_language(decompressed_name(file)))};
+            const int saved_errno {errno};
+
+            ::close(fd);
+            errno = saved_errno;
+            return stats;
+        }
+        ::close(fd);
+    }
+
+    const auto language {find_language(file)};
+    const int fd {::open(file, O_RDONLY | O_CLOEXEC)};
+    struct stat st {};
+
+    if (fd == -1) {
+        return std::unexpected {false};
+    }
+
+    /* Block comments and strings can span lines, so --sloc does not split
+     * files into chunks. */
+    if (::fstat(fd, &st) == 0 and
+        (S_ISBLK(st.st_mode) or S_ISCHR(st.st_mode) or S_ISFIFO(st.st_mode) or
+         (cold and S_ISREG(st.st_mode)) or
+         (pool and not options.count_sloc and S_ISREG(st.st_mode) and
+          static_cast<std::size_t>(st.st_size) >=
+              2 * options.tuner->chunk_size()))) {
+        const auto device {S_ISREG(st.st_mode) or S_ISFIFO(st.st_mode)
+                               ? st.st_dev
+                               : st.st_rdev};
+        const auto stats {
+            S_ISBLK(st.st_mode) ? wc_device(options, pool, fd, device, language)
+            : cold and S_ISREG(st.st_mode)
+                ? wc_direct(options, pool, fd,
+                            static_cast<std::uint64_t>(st.st_size), device,
+                            language)
+            : S_ISREG(st.st_mode)
+                ? wc_parallel(options, *pool, fd,
+                              static_cast<std::size_t>(st.st_size))
+                : wc_stream(options, fd, device, language)};
+        const int saved_errno {errno};
+
+        ::close(fd);
+        errno = saved_errno;
+        return stats;
+    }
+    ::close(fd);
+
+    auto is {std::ifstream {file, std::ios::binary}};
+
+    return wc(options, is, st.st_dev, language);
+}
+
+/* Writes the counts of the members of an archive, named ARCHIVE(MEMBER), or
+ * by their names alone if archive is null. */
+static auto write_members(std::ostream& os,
+                          std::ostream& err,
+                          const Options& options,
+                          const FileStatistics& stats,
+                          const char* archive) -> void 
+{
+    if (not stats.members) {
+        return;
+    }
+
+    for (const auto& member : *stats.members) {
+        const auto name {archive ? std::format("{}({})", archive, member.name)
+                                 : member.name};
+
+        write_counts(os, options, member.stats, name.c_str());
+        report_malformed(err, options, member.stats, name.c_str());
+    }
+}
+
+/* Writes the counts of file, and adds them to total_stats unless it is
+ * null. */
+[[nodiscard]] static auto wc_file(const Options& options, 
+                                  const std::expected<FileStatistics, bool>& stats,
+                                  const char* file, 
+                                  FileStatistics* total_stats) -> int 
+{
+    if (not stats) {
+        read_err(std::cerr, file);
+        return EXIT_SUCCESS; /* We only want to exit on overflow. */
+    }
+
+    write_members(std::cout, std::cerr, options, stats.value(), file);
+    write_counts(std::cout, options, stats.value(), file);
+    report_malformed(std::cerr, options, stats.value(), file);
+
+    if (total_stats) {
+        if (const auto added {add_statistics(options, *total_stats, *stats)};
+            not added) {
+            std::cerr << std::format("Error: integer overflow in total {}.\n",
+                                     added.error());
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+[[nodiscard]] static auto wc_file(const Options& options,
+                                  const std::expected<FileStatistics, bool>& stats,
+                                  const char* file) -> int 
+{
+    if (not stats) {
+        read_err(std::cerr, file);
+        return EXIT_FAILURE;
+    }
+
+    write_members(std::cout, std::cerr, options, stats.value(), nullptr);
+    write_counts(std::cout, options, stats.value(), nullptr);
+    report_malformed(std::cerr, options, stats.value(), file);
+
+    return EXIT_SUCCESS;
+}
+
+/* The totals of --sloc for one language. */
+struct LanguageTotals {
+    std::uintmax_t files {0};
+    std::uintmax_t code {0};
+    std::uintmax_t comment {0};
+    std::uintmax_t blank {0};
+};
+
+static auto write_top_words(std::ostream& os,
+                            const Options& options,
+                            const WordFrequencies& frequencies) -> void 
+{
+    for (const auto& entry : frequencies.top(options.top_words)) {
+        os << std::format("  {:>7L}  {}\n", entry.count, entry.word());
+    }
+    os << std::flush;
+}
+
+static auto write_time_buckets(std::ostream& os, const TimeBuckets& buckets)
+    -> void 
+{
+    constexpr std::int64_t day {86400};
+
+    if (buckets.untimed.lines != 0) {
+        os << std::format("  {:>7L}  {:>7L}  {:>7L}  none\n",
+                          buckets.untimed.lines, buckets.untimed.words,
+                          buckets.untimed.bytes);
+    }
+
+    for (const auto& [start, counts] : buckets.buckets) {
+        const auto days {start / day - (start % day < 0 ? 1 : 0)};
+        const auto seconds {start - days * day};
+        const auto date {std::chrono::year_month_day {std::chrono::sys_days {
+            std::chrono::days {days}}}};
+
+        os << std::format("  {:>7L}  {:>7L}  {:>7L}  "
+                          "{:04}-{:02}-{:02}T{:02}:{:02}:{:02}\n",
+                          counts.lines, counts.words, counts.bytes,
+                          static_cast<int>(date.year()),
+                          static_cast<unsigned>(date.month()),
+                          static_cast<unsigned>(date.day()), seconds / 3600,
+                          seconds / 60 % 60, seconds % 60);
+    }
+    os << std::flush;
+}
+
+static auto add_language_totals(std::span<LanguageTotals> totals,
+                                const FileStatistics& stats) -> void 
+{
+    if (stats.members) {
+        for (const auto& member : *stats.members) {
+            add_language_totals(totals, member.stats);
+        }
+        return;
+    }
+
+    if (stats.sloc_language == -1) {
+        return;
+    }
+
+    auto& language {totals[static_cast<std::size_t>(stats.sloc_language)]};
+
+    ++language.files;
+    language.code += stats.sloc_code;
+    language.comment += stats.sloc_comment;
+    language.blank += stats.sloc_blank;
+}
+
+static auto write_language_totals(std::ostream& os,
+                                  std::span<const LanguageTotals> totals) -> void 
+{
+    for (std::size_t i {0}; i < totals.size(); ++i) {
+        const auto& language {totals[i]};
+
+        if (language.files != 0) {
+            os << std::format("  {:>7L}  {:>7L}  {:>7L}  {} ({:L} {})\n",
+                              language.code, language.comment, language.blank,
+                              languages[i].name, language.files,
+                              language.files == 1 ? "file" : "files");
+        }
+    }
+    os << std::flush;
+}
+
+/* Reads a big-endian number, as in the index of git. */
+[[nodiscard]] static auto load_be32(const char* p) -> std::uint32_t 
+{
+    const auto v {load32(p)};
+
+    return std::endian::native == std::endian::little ? std::byteswap(v) : v;
+}
+
+[[nodiscard]] static auto load_be16(const char* p) -> std::uint16_t 
+{
+    const auto v {load16(p)};
+
+    return std::endian::native == std::endian::little ? std::byteswap(v) : v;
+}
+
+/* A file of the work tree, as listed by the index of git, with the object id
+ * of its content and the stat data that it had then, truncated to 32 bits as
+ * git keeps it: ctime, mtime, inode, uid, gid and size. */
+struct GitEntry {
+    std::string name {};
+    std::array<unsigned char, 32> oid {}; /* SHA-1 ids are padded with 0. */
+    std::array<std::uint32_t, 8> stat {};
+    bool regular {false}; /* Not a symbolic link. */
+};
+
+/* Returns the stat data of st in the form of GitEntry::stat. */
+[[nodiscard]] static auto git_stat(const struct stat& st)
+    -> std::array<std::uint32_t, 8> 
+{
+    const auto u32 {[](auto v) { return static_cast<std::uint32_t>(v); }};
+
+    return {u32(st.st_ctim.tv_sec), u32(st.st_ctim.tv_nsec),
+            u32(st.st_mtim.tv_sec), u32(st.st_mtim.tv_nsec),
+            u32(st.st_ino),         u32(st.st_uid),
+            u32(st.st_gid),         u32(st.st_size)};
+}
+
+/* A directory in a work tree of git. */
+struct GitWorkTree {
+    fs::path git_dir;
+
+    /* The path of the directory in the work tree, with a trailing slash as
+     * the names of the index have, or empty at the top. */
+    std::string prefix;
+};
+
+/* Returns the work tree that the directory at path is in: the closest of it
+ * and its parents with a .git directory, or a .git file naming the git
+ * directory, as linked work trees and submodules have. */
+[[nodiscard]] static auto find_work_tree(const fs::path& path)
+    -> std::expected<GitWorkTree, std::string> 
+{
+    auto ec {std::error_code {}};
+    const auto directory {fs::canonical(path, ec)};
+
+    if (ec or not fs::is_directory(directory, ec)) {
+        return std::unexpected {std::string {"not a directory"}};
+    }
+
+    for (auto top {directory};; top = top.parent_path()) {
+        const auto dot_git {top / ".git"};
+        auto git_dir {std::optional<fs::path> {}};
+
+        if (fs::is_directory(dot_git, ec)) {
+            git_dir = dot_git;
+        } else if (auto is {std::ifstream {dot_git}}) {
+            auto line {std::string {}};
+            constexpr std::string_view prefix {"gitdir: "};
+
+            if (not std::getline(is, line) or not line.starts_with(prefix)) {
+                return std::unexpected {std::string {"not a git work tree"}};
+            }
+            git_dir =
+                fs::weakly_canonical(top / line.substr(prefix.size()), ec);
+        }
+
+        if (git_dir) {
+            const auto relative {directory.lexically_relative(top)};
+
+            return GitWorkTree {*git_dir, relative == "."
+                                              ? std::string {}
+                                              : relative.string() + '/'};
+        }
+
+        if (top == top.parent_path()) {
+            return std::unexpected {std::string {"not a git work tree"}};
+        }
+    }
+}
+
+/* Returns the size of the object ids of the repository of git_dir, from the
+ * objectformat of its config, or of the common directory of a linked work
+ * tree. */
+[[nodiscard]] static auto git_hash_size(const fs::path& git_dir) -> std::size_t 
+{
+    auto common_dir {git_dir};
+    auto line {std::string {}};
+
+    if (auto is {std::ifstream {git_dir / "commondir"}}; std::getline(is, line)) {
+        common_dir = fs::path {line}.is_absolute() ? fs::path {line}
+                                                   : git_dir / line;
+    }
+
+    for (auto is {std::ifstream {common_dir / "config"}}; std::getline(is, line);) {
+        if (line.find("objectformat") != std::string::npos and
+            line.find("sha256") != std::string::npos) {
+            return 32;
+        }
+    }
+    return 20;
+}
+
+/* Reads an index of git, of version 2 to 4, and returns the entries of the
+ * files in the work tree: not those of submodules, of sparse directories, or
+ * outside the sparse checkout, and only one of each conflicted file. */
+[[nodiscard]] static auto read_git_index(const fs::path& file,
+                                         std::size_t hash_size)
+    -> std::expected<std::vector<GitEntry>, std::string> 
+{
+    auto is {std::ifstream {file, std::ios::binary}};
+
+    if (not is.is_open()) {
+        return std::unexpected {
+            std::error_code {errno, std::generic_category()}.message()};
+    }
+
+    const auto data {std::string {std::istreambuf_iterator<char> {is}, {}}};
+    const auto malformed {std::unexpected {std::string {"malformed index"}}};
+
+    if (is.bad()) {
+        return std::unexpected {
+            std::error_code {errno, std::generic_category()}.message()};
+    }
+
+    if (data.size() < 12 or not data.starts_with("DIRC")) {
+        return malformed;
+    }
+
+    const auto version {load_be32(data.data() + 4)};
+    const auto nentries {load_be32(data.data() + 8)};
+
+    if (version < 2 or version > 4) {
+        return std::unexpected {
+            std::format("unsupported index version {}", version)};
+    }
+
+    /* ctime, mtime, dev, ino, mode, uid, gid and size, then the object id and
+     * the flags. */
+    const auto fixed_size {40 + hash_size + 2};
+    /* The offsets of the stat data of GitEntry: dev and mode, at 16 and 24,
+     * are not compared, as by git. */
+    constexpr std::size_t stat_fields[] {0, 4, 8, 12, 20, 28, 32, 36};
+    auto entries {std::vector<GitEntry> {}};
+    auto name {std::string {}};
+    std::size_t offset {12};
+
+    for (std::uint32_t i {0}; i < nentries; ++i) {
+        if (offset > data.size() or data.size() - offset < fixed_size) {
+            return malformed;
+        }
+
+        const char* const p {data.data() + offset};
+        const auto mode {load_be32(p + 24)};
+        const auto flags {load_be16(p + 40 + hash_size)};
+        std::size_t position {offset + fixed_size};
+        std::uint16_t extended_flags {0};
+
+        if ((flags & 0x4000) != 0) {
+            if (version < 3 or data.size() - position < 2) {
+                return malformed;
+            }
+
+            extended_flags = load_be16(data.data() + position);
+            position += 2;
+        }
+
+        if (version == 4) {
+            /* The length of the end of the previous name to remove, in the
+             * variable-length encoding of git, then the rest of the name. */
+            if (position == data.size()) {
+                return malformed;
+            }
+
+            auto c {static_cast<unsigned char>(data[position++])};
+            std::size_t strip {c & 0x7fU};
+
+            while ((c & 0x80) != 0) {
+                if (position == data.size()) {
+                    return malformed;
+                }
+
+                c = static_cast<unsigned char>(data[position++]);
+                strip = ((strip + 1) << 7) | (c & 0x7fU);
+            }
+
+            const auto end {data.find('\0', position)};
+
+            if (strip > name.size() or end == std::string::npos) {
+                return malformed;
+            }
+
+            name.resize(name.size() - strip);
+            name.append(data, position, end - position);
+            offset = end + 1;
+        } else {
+            const auto end {data.find('\0', position)};
+
+            if (end == std::string::npos) {
+                return malformed;
+            }
+
+            /* Entries are padded with 1 to 8 NULs to a multiple of 8 bytes. */
+            const auto next {offset + ((end - offset + 8) & ~std::size_t {7})};
+
+            if (next > data.size() or
+                data.find_first_not_of('\0', end) < next) {
+                return malformed;
+            }
+
+            name.assign(data, position, end - position);
+            offset = next;
+        }
+
+        const auto type {mode & 0170000};
+        const bool conflicted {((flags >> 12) & 3) != 0};
+        const bool skip_worktree {(extended_flags & 0x4000) != 0};
+
+        if ((type != 0100000 and type != 0120000) or skip_worktree or
+            (conflicted and not entries.empty() and entries.back().name == name)) {
+            continue;
+        }
+
+        auto& entry {entries.emplace_back()};
+
+        entry.name = name;
+        std::memcpy(entry.oid.data(), p + 40, hash_size);
+
+        for (std::size_t j {0}; j < entry.stat.size(); ++j) {
+            entry.stat[j] = load_be32(p + stat_fields[j]);
+        }
+        entry.regular = type == 0100000 and not conflicted;
+    }
+    return entries;
+}
+
+/* The counts of files tracked by git, by the object id of their content, the
+ * options and locale that they were counted with and their language, kept in
+ * the git directory between runs of --git. Only counts that are single
+ * numbers are kept, and only those found or counted by the last run that
+ * counted any. */
+class GitCache {
+public:
+    struct Key {
+        std::array<unsigned char, 32> oid {};
+        std::uint32_t options {0};
+        std::int32_t language {-1};
+        std::uint64_t locale {0};
+
+        auto operator<=>(const Key&) const = default;
+    };
+
+    /* Returns the options that counts are kept for, as a key, or nothing if
+     * some of them are not single numbers, or depend on more than the
+     * content and language of files. */
+    [[nodiscard]] static auto key_options(const Options& options)
+        -> std::optional<std::uint32_t> 
+    {
+        if (options.count_distinct_lines or
+            options.approx_distinct != ApproxDistinct::none or
+            options.top_words != 0 or options.token_vocabulary or
+            options.bucket_width != 0 or options.decompress or options.tar or
+            options.zip) {
+            return std::nullopt;
+        }
+
+        std::uint32_t key {0};
+        std::uint32_t bit {1};
+
+        for (const bool option :
+             {options.count_bytes, options.count_lines, options.count_words,
+              options.count_max_line_length, options.count_csv,
+              options.count_jsonl, options.count_sloc, options.count_tokens,
+              options.hash == HashAlgorithm::crc32c,
+              options.hash == HashAlgorithm::xxh3}) {
+            key |= option ? bit : 0;
+            bit <<= 1;
+        }
+        return key;
+    }
+
+    /* Returns the character type locale, as a key: it tells which bytes are
+     * spaces. */
+    [[nodiscard]] static auto key_locale() -> std::uint64_t
+    {
+        const char* const name {std::setlocale(LC_CTYPE, nullptr)};
+
+        return hash_bytes(name ? name : "");
+    }
+
+    /* Loads the cache saved in file, or returns an empty one if there is none
+     * or it cannot be read. */
+    [[nodiscard]] static auto load(const fs::path& file) -> GitCache
+    {
+        auto is {std::ifstream {file, std::ios::binary}};
+        auto cache {GitCache {}};
+        char header[6] {};
+
+        if (not is.read(header, sizeof header) or
+            std::memcmp(header, "WCGIT\2", sizeof header) != 0) {
+            return cache;
+        }
+
+        auto key {Key {}};
+        auto counts {Counts {}};
+
+        while (is.read(reinterpret_cast<char*>(&key), sizeof key) and
+               is.read(reinterpret_cast<char*>(counts.data()),
+                       sizeof(Counts))) {
+            cache.entries.insert_or_assign(key, Entry {counts, false});
+        }
+        return cache;
+    }
+
+    /* Saves the entries found or inserted to file, by renaming a new file
+     * over it. */
+    [[nodiscard]] auto save(const fs::path& file) const -> bool
+    {
+        auto temporary {file};
+
+        temporary += std::format(".{}", ::getpid());
+
+        auto os {std::ofstream {temporary, std::ios::binary}};
+
+        os.write("WCGIT\2", 6);
+
+        for (const auto& [key, entry] : entries) {
+            if (entry.used) {
+                os.write(reinterpret_cast<const char*>(&key), sizeof key);
+                os.write(reinterpret_cast<const char*>(entry.counts.data()),
+                         sizeof entry.counts);
+            }
+        }
+        os.close();
+
+        if (os.fail() or ::rename(temporary.c_str(), file.c_str()) == -1) {
+            const int saved_errno {errno};
+
+            ::unlink(temporary.c_str());
+            errno = saved_errno;
+            return false;
+        }
+        return true;
+    }
+
+    [[nodiscard]] auto find(const Key& key) -> std::optional<FileStatistics>
+    {
+        const auto found {entries.find(key)};
+
+        if (found == entries.end()) {
+            return std::nullopt;
+        }
+
+        found->second.used = true;
+
+        const auto& counts {found->second.counts};
+        auto stats {FileStatistics {}};
+        auto field {counts.begin()};
+
+        for (auto* const count : count_fields(stats)) {
+            *count = *field++;
+        }
+
+        stats.sloc_language = static_cast<int>(*field++) - 1;
+
+        if (*field++ != 0) {
+            stats.hash = *field;
+        }
+        return stats;
+    }
+
+    auto insert(const Key& key, const FileStatistics& stats) -> void
+    {
+        auto counts {Counts {}};
+        auto copy {stats};
+        auto field {counts.begin()};
+
+        for (auto* const count : count_fields(copy)) {
+            *field++ = *count;
+        }
+
+        *field++ = static_cast<std::uint64_t>(stats.sloc_language + 1);
+        *field++ = stats.hash.has_value();
+        *field = stats.hash.value_or(0);
+        entries.insert_or_assign(key, Entry {counts, true});
+        changed = true;
+    }
+
+    /* Whether anything was inserted since the cache was loaded. */
+    [[nodiscard]] auto modified() const -> bool
+    {
+        return changed;
+    }
+
+private:
+    [[nodiscard]] static auto count_fields(FileStatistics& stats)
+        -> std::array<std::uintmax_t*, 15> 
+    {
+        return {&stats.lines,           &stats.words,
+                &stats.bytes,           &stats.max_line_length,
+                &stats.csv_records,     &stats.csv_min_fields,
+                &stats.csv_max_fields,  &stats.jsonl_records,
+                &stats.jsonl_empty,     &stats.jsonl_malformed,
+                &stats.jsonl_first_malformed, &stats.sloc_code,
+                &stats.sloc_comment,    &stats.sloc_blank,
+                &stats.tokens};
+    }
+
+    /* The counts of count_fields(), the language plus one, whether there is
+     * a hash, and the hash. */
+    using Counts = std::array<std::uint64_t, 18>;
+
+    struct Entry {
+        Counts counts;
+        bool used; /* Found or inserted since the cache was loaded. */
+    };
+
+    std::map<Key, Entry> entries {};
+    bool changed {false};
+};
+
+/* A git repository whose tracked files are inputs of --git. */
+struct GitRepository {
+    fs::path git_dir;
+    GitCache cache;
+};
+
+/* An input of --git: a tracked file, whose counts are kept in the cache of
+ * its repository if it is clean, that is, if its stat data is still that of
+ * the index entry, so that its content is still the object of that entry. */
+struct GitFile {
+    GitRepository* repository {nullptr};
+    GitCache::Key key {};
+    bool clean {false};
+
+    /* The counts kept in the cache, if clean. */
+    std::optional<FileStatistics> cached {};
+};
+
+struct Input {
+    std::string path;
+    fs::file_type type;
+
+    /* The index of an earlier input of the same regular file, if any. */
+    std::optional<std::size_t> same_as {};
+
+    /* Whether a later input is the same regular file. */
+    bool repeated {false};
+
+    std::optional<GitFile> git {};
+};
+
+/* Returns the FILE arguments, with directories replaced by the regular files
+ * under them, in sorted order, if options.recursive is set. */
+[[nodiscard]] static auto collect_inputs(const Options& options,
+                                         std::span<char*> args)
+    -> std::vector<Input> 
+{
+    auto inputs {std::vector<Input> {}};
+
+    for (const char* arg : args) {
+        auto ec {std::error_code {}};
+        const auto type {fs::status(arg, ec).type()};
+
+        if (type != fs::file_type::directory or not options.recursive) {
+            inputs.push_back(Input {arg, type});
+            continue;
+        }
+
+        auto files {std::vector<Input> {}};
+
+        for (auto it {fs::recursive_directory_iterator {
+                 arg, fs::directory_options::skip_permission_denied, ec}};
+             not ec and it != fs::recursive_directory_iterator {};
+             it.increment(ec)) {
+            if (it->is_regular_file(ec)) {
+                files.push_back(Input {it->path().string(),
+                                       fs::file_type::regular});
+            }
+        }
+
+        if (ec) {
+            std::cerr << std::format("wc: {}: {}.\n", arg, ec.message());
+        }
+
+        std::ranges::sort(files, {}, &Input::path);
+        inputs.insert(inputs.end(), std::make_move_iterator(files.begin()),
+                      std::make_move_iterator(files.end()));
+    }
+    return inputs;
+}
+
+/* Returns the files tracked by git under the FILE arguments, or the current
+ * directory if there are none, which may be anywhere in a work tree, in the
+ * order of their indexes, and adds the repositories to repositories, once
+ * each. The counts of clean files are looked up in the cache of their
+ * repository. */
+[[nodiscard]] static auto collect_git_inputs(
+    const Options& options,
+    std::span<char*> args,
+    std::deque<GitRepository>& repositories) -> std::vector<Input> 
+{
+    const auto key_options {GitCache::key_options(options)};
+    const auto key_locale {GitCache::key_locale()};
+    auto trees {std::vector<std::string> {args.begin(), args.end()}};
+    auto inputs {std::vector<Input> {}};
+
+    if (trees.empty()) {
+        trees.emplace_back(".");
+    }
+
+    for (const auto& tree : trees) {
+        const auto work_tree {find_work_tree(tree)};
+
+        if (not work_tree) {
+            std::cerr << std::format("wc: {}: {}.\n", tree, work_tree.error());
+            continue;
+        }
+
+        const auto& git_dir {work_tree->git_dir};
+        const auto index {git_dir / "index"};
+        const auto entries {read_git_index(index, git_hash_size(git_dir))};
+
+        if (not entries) {
+            std::cerr << std::format("wc: {}: {}.\n", index.string(),
+                                     entries.error());
+            continue;
+        }
+
+        /* An entry whose mtime is not before that of the index may have been
+         * changed since, within the resolution of the clock, without its
+         * stat data changing: git itself rereads such racily clean files. */
+        struct stat index_st {};
+        static_cast<void>(::stat(index.c_str(), &index_st));
+        const auto index_mtime {std::pair {
+            static_cast<std::uint32_t>(index_st.st_mtim.tv_sec),
+            static_cast<std::uint32_t>(index_st.st_mtim.tv_nsec)}};
+
+        const auto found {
+            std::ranges::find(repositories, git_dir, &GitRepository::git_dir)};
+        auto& repository {
+            found != repositories.end()
+                ? *found
+                : repositories.emplace_back(GitRepository {
+                      git_dir, GitCache::load(git_dir / "wc-cache")})};
+
+        for (const auto& entry : *entries) {
+            if (not entry.name.starts_with(work_tree->prefix)) {
+                continue;
+            }
+
+            const auto name {
+                std::string_view {entry.name}.substr(work_tree->prefix.size())};
+            auto path {tree == "." ? std::string {name}
+                                   : (fs::path {tree} / name).string()};
+            struct stat st {};
+            auto ec {std::error_code {}};
+            const bool found {::lstat(path.c_str(), &st) == 0};
+            const auto type {found and S_ISREG(st.st_mode)
+                                 ? fs::file_type::regular
+                                 : fs::status(path, ec).type()};
+            const bool clean {key_options and entry.regular and found and
+                              S_ISREG(st.st_mode) and
+                              git_stat(st) == entry.stat and
+                              std::pair {entry.stat[2], entry.stat[3]} <
+                                  index_mtime};
+            auto& input {inputs.emplace_back(Input {std::move(path), type})};
+
+            input.git = GitFile {
+                &repository,
+                GitCache::Key {entry.oid, key_options.value_or(0),
+                               find_language(input.path), key_locale},
+                clean};
+
+            if (clean) {
+                input.git->cached = repository.cache.find(input.git->key);
+            }
+        }
+    }
+    return inputs;
+}
+
+/* Returns the device, size and extent list of the file at path, which are
+ * the same only for files with the same data, or nothing if FIEMAP does not
+ * give the physical location of all of it. */
+[[nodiscard]] static auto extent_fingerprint(const char* path,
+                                             const struct stat& st)
+    -> std::string 
+{
+    constexpr unsigned batch {256};
+    /* Inline and tail data is in metadata, at no address of its own, and
+     * encoded or unaligned data may not be all of its extent. */
+    constexpr std::uint32_t unplaced {FIEMAP_EXTENT_UNKNOWN |
+                                      FIEMAP_EXTENT_DELALLOC |
+                                      FIEMAP_EXTENT_ENCODED |
+                                      FIEMAP_EXTENT_DATA_INLINE |
+                                      FIEMAP_EXTENT_DATA_TAIL |
+                                      FIEMAP_EXTENT_NOT_ALIGNED};
+    const int fd {::open(path, O_RDONLY | O_CLOEXEC)};
+
+    if (fd == -1) {
+        return {};
+    }
+
+    auto fingerprint {std::string {}};
+    const auto append {[&fingerprint](const auto& value) {
+        fingerprint.append(reinterpret_cast<const char*>(&value), sizeof value);
+    }};
+    auto buffer {std::vector<std::uint64_t>(
+        (sizeof(::fiemap) + batch * sizeof(::fiemap_extent)) /
+        sizeof(std::uint64_t))};
+    auto* const map {reinterpret_cast<::fiemap*>(buffer.data())};
+    std::uint64_t start {0};
+    bool last {false};
+
+    append(st.st_dev);
+    append(st.st_size);
+
+    while (not last) {
+        *map = ::fiemap {};
+        map->fm_start = start;
+        map->fm_length = FIEMAP_MAX_OFFSET - start;
+        map->fm_flags = FIEMAP_FLAG_SYNC;
+        map->fm_extent_count = batch;
+
+        if (::ioctl(fd, FS_IOC_FIEMAP, map) == -1 or map->fm_mapped_extents == 0) {
+            break;
+        }
+
+        for (unsigned i {0}; i < map->fm_mapped_extents; ++i) {
+            const auto& extent {map->fm_extents[i]};
+
+            if ((extent.fe_flags & unplaced) != 0) {
+                ::close(fd);
+                return {};
+            }
+
+            append(extent.fe_logical);
+            append(extent.fe_physical);
+            append(extent.fe_length);
+            start = extent.fe_logical + extent.fe_length;
+            last = (extent.fe_flags & FIEMAP_EXTENT_LAST) != 0;
+        }
+    }
+
+    ::close(fd);
+    return last ? fingerprint : std::string {};
+}
+
+/* Finds the regular files of inputs that are the same file, by device and
+ * inode, as an earlier input: repeated arguments, overlapping directories
+ * and hard links, and with --dedup-extents, files that share all their
+ * extents with one. Names of different languages are counted apart. */
+static auto find_repeats(const Options& options, std::span<Input> inputs)
+    -> void 
+{
+    auto seen {WordTable {}};
+    auto seen_extents {WordTable {}};
+
+    for (std::size_t i {0}; i < inputs.size(); ++i) {
+        struct stat st {};
+
+        if (inputs[i].type != fs::file_type::regular or
+            ::stat(inputs[i].path.c_str(), &st) == -1) {
+            continue;
+        }
+
+        const int language {find_language(inputs[i].path)};
+        char key[sizeof st.st_dev + sizeof st.st_ino + sizeof language];
+
+        std::memcpy(key, &st.st_dev, sizeof st.st_dev);
+        std::memcpy(key + sizeof st.st_dev, &st.st_ino, sizeof st.st_ino);
+        std::memcpy(key + sizeof st.st_dev + sizeof st.st_ino, &language,
+                    sizeof language);
+
+        const auto id {std::string_view {key, sizeof key}};
+        /* The index of the first input of the file, plus 1. */
+        auto& first {seen.find(hash_bytes(id), id)};
+
+        if (first == 0 and options.dedup_extents) {
+            auto fingerprint {extent_fingerprint(inputs[i].path.c_str(), st)};
+
+            if (not fingerprint.empty()) {
+                fingerprint.append(reinterpret_cast<const char*>(&language),
+                                   sizeof language);
+                auto& first_extents {
+                    seen_extents.find(hash_bytes(fingerprint), fingerprint)};
+
+                first_extents = first_extents == 0 ? i + 1 : first_extents;
+                first = first_extents;
+            }
+        }
+
+        if (first == 0) {
+            first = i + 1;
+        } else if (first != i + 1) {
+            inputs[i].same_as = first - 1;
+            inputs[first - 1].repeated = true;
+        }
+    }
+}
+
+/* A FIFO argument counted by wc_pipes(). */
+struct PipeInput {
+    std::size_t index {0}; /* In the inputs. */
+    std::expected<FileStatistics, bool> stats {};
+    int error {0};
+};
+
+/* Counts the FIFOs of pipes together, reading whichever epoll reports ready,
+ * so that a producer writing to several of them, as with tee, never blocks on
+ * one that is not being read. They are opened non-blocking: Linux reports no
+ * hangup on a FIFO before it has had a writer. Their data is not decoded. */
+static auto wc_pipes(const Options& options,
+                     std::span<const Input> inputs,
+                     std::span<PipeInput> pipes) -> void 
+{
+    constexpr int pipe_size {1 << 20};
+    constexpr int max_events {64};
+    const int epoll {::epoll_create1(EPOLL_CLOEXEC)};
+
+    const auto fail {[](PipeInput& pipe) {
+        pipe.stats = std::unexpected {false};
+        pipe.error = errno;
+    }};
+
+    if (epoll == -1) {
+        std::ranges::for_each(pipes, fail);
+        return;
+    }
+
+    auto fds {std::vector<int>(pipes.size(), -1)};
+    auto counters {std::vector<Counter>(pipes.size())};
+    std::size_t nopen {0};
+
+    for (std::size_t i {0}; i < pipes.size(); ++i) {
+        const auto& path {inputs[pipes[i].index].path};
+        auto event {::epoll_event {}};
+
+        fds[i] = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+        event.events = EPOLLIN;
+        event.data.u64 = i;
+
+        if (fds[i] == -1 or ::epoll_ctl(epoll, EPOLL_CTL_ADD, fds[i], &event) == -1) {
+            fail(pipes[i]);
+
+            if (fds[i] != -1) {
+                ::close(fds[i]);
+            }
+            continue;
+        }
+
+        static_cast<void>(::fcntl(fds[i], F_SETPIPE_SZ, pipe_size));
+        counters[i] = make_counter(options, false, find_language(path));
+        ++nopen;
+    }
+
+    const auto buffer {options.buffers->acquire()};
+    const auto buffer_size {options.buffers->size()};
+    ::epoll_event events[max_events];
+
+    if (not buffer) {
+        for (std::size_t i {0}; i < pipes.size(); ++i) {
+            if (fds[i] != -1) {
+                fail(pipes[i]);
+                ::close(fds[i]);
+            }
+        }
+        nopen = 0;
+    }
+
+    while (nopen != 0) {
+        const int nevents {::epoll_wait(epoll, events, max_events, -1)};
+
+        if (nevents == -1 and errno == EINTR) {
+            continue;
+        }
+
+        if (nevents == -1) {
+            for (std::size_t i {0}; i < pipes.size(); ++i) {
+                if (fds[i] != -1 and pipes[i].error == 0) {
+                    fail(pipes[i]);
+                    ::close(fds[i]);
+                }
+            }
+            break;
+        }
+
+        /* Each ready pipe is read once per wait, so that none starves the
+         * others. */
+        for (int k {0}; k < nevents; ++k) {
+            const std::size_t i {events[k].data.u64};
+            const auto n {::read(fds[i], buffer.get(), buffer_size)};
+
+            if (n > 0) {
+                feed(counters[i], options,
+                     {buffer.get(), static_cast<std::size_t>(n)});
+                continue;
+            }
+
+            if (n == -1 and (errno == EAGAIN or errno == EINTR)) {
+                continue;
+            }
+
+            if (n == 0) {
+                pipes[i].stats = finish(counters[i]);
+                pipes[i].error = pipes[i].stats ? 0 : errno;
+            } else {
+                fail(pipes[i]);
+            }
+
+            ::close(fds[i]);
+            --nopen;
+        }
+    }
+    ::close(epoll);
+}
+
+auto main(int argc, char* argv[]) -> int 
+{
+    std::locale::global(std::locale(""));
+    std::cin.tie(nullptr);
+
+    auto options {parse_options(argc, argv)};
+
+    if (not options) {
+        if (options.error() == ParseOptionsError::help_requested) {
+            help(std::cout, argv[0]);
+            return EXIT_SUCCESS;
+        }
+
+        if (options.error() == ParseOptionsError::unknown_option) {
+            usage_err(std::cerr, argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        if (options.error() == ParseOptionsError::invalid_argument) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (not(options->count_lines or options->count_words or
+            options->count_bytes or options->count_max_line_length or
+            options->count_csv or options->count_jsonl or 
+            options->count_sloc or options->count_distinct_lines or
+            options->approx_distinct != ApproxDistinct::none or
+            options->count_tokens)) {
+        options->count_lines = options->count_words = options->count_bytes =
+            true;
+    }
+
+    if (options->token_vocabulary) {
+        auto vocabulary {BpeVocabulary::load(options->token_vocabulary)};
+
+        if (not vocabulary) {
+            std::cerr << std::format("wc: {}: {}.\n", options->token_vocabulary,
+                                     vocabulary.error());
+            return EXIT_FAILURE;
+        }
+        options->vocabulary =
+            std::make_shared<const BpeVocabulary>(std::move(vocabulary.value()));
+    }
+
+    /* Read and decompression buffers together take at most 64 MiB as the
+     * tuner grows them, or a quarter of --max-memory. */
+    const auto read_memory {options->max_memory != 0
+                                ? std::min(options->max_memory / 4,
+                                           std::size_t {64} << 20)
+                                : std::size_t {64} << 20};
+    const auto largest_buffer {
+        std::clamp(std::bit_floor(std::max<std::size_t>(
+                       read_memory / (options->jobs + 1), 1)),
+                   SizeTuner::min_size, SizeTuner::max_size)};
+
+    options->budget = std::make_shared<MemoryBudget>(options->max_memory);
+    options->buffers = std::make_shared<BufferPool>(
+        options->buffer_size != 0 ? options->buffer_size : largest_buffer,
+        *options->budget);
+    options->tuner = std::make_shared<SizeTuner>(
+        options->buffer_size != 0 ? options->buffers->size() : 0,
+        largest_buffer);
+
+    /* The device that standard input is read from, for the tuner. */
+    const auto stdin_device {[] {
+        struct stat st {};
+
+        if (::fstat(STDIN_FILENO, &st) == -1) {
+            return dev_t {0};
+        }
+        return S_ISBLK(st.st_mode) or S_ISCHR(st.st_mode) ? st.st_rdev
+                                                          : st.st_dev;
+    }()};
+
+    /* The time buckets of all the inputs. */
+    auto total_buckets {std::shared_ptr<TimeBuckets> {}};
+
+    if (options->bucket_width != 0) {
+        total_buckets = std::make_shared<TimeBuckets>();
+    }
+
+    /* The word frequencies of all the inputs. */
+    auto total_frequencies {std::shared_ptr<WordFrequencies> {}};
+
+    if (options->top_words != 0) {
+        total_frequencies = std::make_shared<WordFrequencies>(
+            options->top_words, options->top_words_sketch, *options->budget);
+    }
+
+    /* The union of the sketches of all the inputs and of --sketch-in. */
+    auto total_sketch {std::shared_ptr<HyperLogLog> {}};
+
+    if (options->approx_distinct != ApproxDistinct::none) {
+        total_sketch = std::make_shared<HyperLogLog>(options->hll_precision);
+
+        for (const char* file : options->sketch_in) {
+            const auto sketch {HyperLogLog::load(file)};
+
+            if (not sketch) {
+                std::cerr << std::format("wc: {}: {}.\n", file, sketch.error());
+                return EXIT_FAILURE;
+            }
+
+            if (not total_sketch->merge(sketch.value())) {
+                std::cerr << std::format(
+                    "wc: {}: the sketch precision is not {}.\n", file,
+                    options->hll_precision);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    if (optind == argc and options->sketch_in.empty() and not options->git) {
+        std::ios_base::sync_with_stdio(false);
+
+        const auto stats {options->tar ? wc_tar(options.value(), STDIN_FILENO)
+            : options->zip ? wc_zip(options.value(), nullptr, STDIN_FILENO)
+            : options->decompress
+            ? wc_decompressed(options.value(), STDIN_FILENO, -1)
+            : wc(options.value(), std::cin, stdin_device, -1)};
+        const int status {wc_file(options.value(), stats, "stdin")};
+
+        if (status == EXIT_SUCCESS and options->sketch_out and 
+            not stats->sketch->save(options->sketch_out)) {
+            read_err(std::cerr, options->sketch_out);
+            return EXIT_FAILURE;
+        }
+
+        if (status == EXIT_SUCCESS and stats->buckets) {
+            write_time_buckets(std::cout, *stats->buckets);
+        }
+
+        if (status == EXIT_SUCCESS and stats->word_frequencies) {
+            write_top_words(std::cout, options.value(), *stats->word_frequencies);
+        }
+        return status;
+    }
+
+    /* The repositories of --git, which inputs refer to. */
+    auto repositories {std::deque<GitRepository> {}};
+    const auto args {
+        std::span {argv + optind, static_cast<std::size_t>(argc - optind)}};
+    auto inputs {options->git
+                     ? collect_git_inputs(options.value(), args, repositories)
+                     : collect_inputs(options.value(), args)};
+
+    if (optind == argc and not options->git) {
+        inputs.push_back(Input {"-", fs::file_type::not_found});
+    }
+
+    find_repeats(options.value(), inputs);
+
+    /* A regular file or block device counted on the thread pool ahead of its
+     * turn. */
+    struct Ahead {
+        std::size_t index {0};
+        std::expected<FileStatistics, bool> stats {};
+        int error {0};
+        ThreadPool* pool {nullptr};
+        std::future<void> done {};
+    };
+
+    auto ahead {std::deque<Ahead> {}};
+
+    /* A file that later inputs repeat, by the index of its first. */
+    struct Counted {
+        std::expected<FileStatistics, bool> stats {};
+        int error {0};
+    };
+
+    auto repeated {std::map<std::size_t, Counted> {}};
+
+    /* FIFO arguments, such as process substitutions, read together from the
+     * start, on the thread pool if there is one. */
+    auto pipes {std::vector<PipeInput> {}};
+    auto pipes_done {std::future<void> {}};
+
+    /* Declared after everything its tasks refer to, so that it is destroyed,
+     * and its tasks are finished, first. */
+    auto pool {std::optional<ThreadPool> {}};
+
+    /* Cold files, mostly not in the page cache, are counted on threads of
+     * their own device, which mostly wait for it, so that their reads overlap
+     * the counting of cached files on the others. Each device reads as many
+     * files at once as it queues requests, up to the jobs, but a rotational
+     * one reads one at a time, in the order of where they are on it. */
+    auto device_pools {std::map<dev_t, ThreadPool> {}};
+
+    /* Without -j, the next few regular files are prefetched on a thread of
+     * their own while each is counted, so that the first reads of each find
+     * their data in the page cache, or on its way there. */
+    auto prefetcher {std::optional<ThreadPool> {}};
+
+    if (options->jobs > 1) {
+        pool.emplace(options->jobs);
+    } else {
+        prefetcher.emplace(1U);
+    }
+
+    ThreadPool* const workers {pool ? &*pool : nullptr};
+    const auto device_pool {[&device_pools, jobs = options->jobs](dev_t device)
+                                -> ThreadPool& {
+        auto found {device_pools.find(device)};
+
+        if (found == device_pools.end()) {
+            const auto queue {find_device_queue(device)};
+            const auto nthreads {not queue ? jobs
+                : queue->rotational        ? 1U
+                : std::clamp(queue->requests, 1U, jobs)};
+
+            found = device_pools.try_emplace(device, nthreads, true).first;
+        }
+        return found->second;
+    }};
+
+    std::size_t next_pipe {0};
+    /* Decoders read their input themselves, one FIFO after the other. */
+    const bool decoding {options->decompress or options->tar or options->zip};
+
+    for (std::size_t i {0}; i < inputs.size() and not decoding; ++i) {
+        if (inputs[i].type == fs::file_type::fifo) {
+            pipes.push_back(PipeInput {i});
+        }
+    }
+
+    if (pipes.size() > 1) {
+        const auto read_pipes {[&options = options.value(), &inputs, &pipes] {
+            wc_pipes(options, inputs, pipes);
+        }};
+
+        if (workers) {
+            pipes_done = workers->submit(read_pipes);
+        } else {
+            read_pipes();
+        }
+    } else {
+        pipes.clear();
+    }
+
+    const auto window {workers ? workers->size() * 4 : std::size_t {0}};
+    auto total_stats {FileStatistics {}};
+    auto language_totals {std::array<LanguageTotals, nlanguages> {}};
+    /* Saved sketches are partial results, and count as inputs of the total. */
+    const int nfiles {static_cast<int>(std::min<std::size_t>(
+        inputs.size() + options->sketch_in.size(), INT_MAX))};
+    std::size_t next {0};
+    std::size_t prefetched {0};
+
+    for (std::size_t i {0}; i < inputs.size(); ++i) {
+        /* No more files are counted ahead once the memory budget is spent,
+         * until the results of those before are written and freed. */
+        for (next = std::max(next, i);
+             next < inputs.size() and ahead.size() < window and
+             not options->budget->exhausted();
+             ++next) {
+            if ((inputs[next].type == fs::file_type::regular or
+                 inputs[next].type == fs::file_type::block) and
+                not inputs[next].same_as and
+                not (inputs[next].git and inputs[next].git->cached)) {
+                auto& job {ahead.emplace_back()};
+                const auto cold {inputs[next].type == fs::file_type::regular
+                    ? find_cold(inputs[next].path.c_str())
+                    : std::nullopt};
+
+                /* A file on a device pool is read by one of its threads. */
+                const auto count {[&options = options.value(),
+                                   &input = inputs[next], &job, workers,
+                                   cold = cold.has_value()] {
+                    job.stats = wc_path(options, cold ? nullptr : workers,
+                                        input.path.c_str(), cold);
+                    job.error = errno;
+                }};
+
+                job.index = next;
+
+                if (cold) {
+                    job.pool = &device_pool(cold->device);
+                    job.done = job.pool->submit(count, cold->offset);
+                } else {
+                    job.pool = workers;
+                    job.done = job.pool->submit(count);
+                }
+            }
+        }
+
+        for (prefetched = std::max(prefetched, i + 1);
+             prefetcher and prefetched < inputs.size() and
+             prefetched <= i + prefetch_files;
+             ++prefetched) {
+            if (inputs[prefetched].type == fs::file_type::regular and
+                not inputs[prefetched].same_as and
+                not (inputs[prefetched].git and inputs[prefetched].git->cached)) {
+                static_cast<void>(prefetcher->submit(
+                    [file = inputs[prefetched].path.c_str()] {
+                        prefetch(file);
+                    }));
+            }
+        }
+
+        const auto& input {inputs[i]};
+        const char* const file {input.path.c_str()};
+
+        if (input.type == fs::file_type::directory) {
+            std::cerr << std::format("wc: {}: Is a directory.\n", file);
+            write_counts(std::cout, options.value(), FileStatistics {0},
+                     file);
+        } else if (input.type == fs::file_type::regular or
+                   input.type == fs::file_type::block or
+                   input.type == fs::file_type::character or
+                   input.type == fs::file_type::fifo) {
+            auto stats {std::expected<FileStatistics, bool> {}};
+
+            if (input.same_as) {
+                const auto& earlier {repeated.at(*input.same_as)};
+
+                stats = earlier.stats;
+                errno = earlier.error;
+            } else if (input.git and input.git->cached) {
+                stats = *input.git->cached;
+            } else if (not ahead.empty() and ahead.front().index == i) {
+                ahead.front().pool->wait(ahead.front().done);
+                stats = std::move(ahead.front().stats);
+                errno = ahead.front().error;
+                ahead.pop_front();
+            } else if (next_pipe < pipes.size() and
+                       pipes[next_pipe].index == i) {
+                if (pipes_done.valid()) {
+                    workers->wait(pipes_done);
+                }
+
+                stats = std::move(pipes[next_pipe].stats);
+                errno = pipes[next_pipe].error;
+                ++next_pipe;
+            } else {
+                stats = wc_path(options.value(), workers, file, false);
+            }
+
+            if (stats and input.git and input.git->clean and
+                not input.git->cached) {
+                input.git->repository->cache.insert(input.git->key, *stats);
+            }
+
+            if (input.repeated) {
+                repeated.emplace(i, Counted {stats, errno});
+            }
+
+            /* With --dedup-total, a file counts in the totals once. */
+            const bool totalled {not(input.same_as and options->dedup_total)};
+
+            if (wc_file(options.value(), stats, file,
+                        nfiles > 1 and totalled ? &total_stats : nullptr) ==
+                EXIT_FAILURE) {
+                return EXIT_FAILURE;
+            }
+
+            if (stats and totalled) {
+                add_language_totals(language_totals, stats.value());
+
+                if (stats->sketch) {
+                    static_cast<void>(total_sketch->merge(*stats->sketch));
+                }
+
+                if (stats->word_frequencies) {
+                    total_frequencies->merge(*stats->word_frequencies);
+                }
+
+                if (stats->buckets) {
+                    add_time_buckets(*total_buckets, *stats->buckets);
+                }
+            }
+        } else if (input.path == "-") {
+            const auto stats {options->tar
+                ? wc_tar(options.value(), STDIN_FILENO)
+                : options->zip ? wc_zip(options.value(), workers, STDIN_FILENO)
+                : options->decompress
+                ? wc_decompressed(options.value(), STDIN_FILENO, -1)
+                : wc(options.value(), std::cin, stdin_device, -1)};
+
+            if (wc_file(options.value(), stats, file,
+                        nfiles > 1 ? &total_stats : nullptr) == EXIT_FAILURE) {
+                return EXIT_FAILURE;
+            }
+
+            if (stats and stats->sketch) {
+                static_cast<void>(total_sketch->merge(*stats->sketch));
+            }
+
+            if (stats and stats->word_frequencies) {
+                total_frequencies->merge(*stats->word_frequencies);
+            }
+
+            if (stats and stats->buckets) {
+                add_time_buckets(*total_buckets, *stats->buckets);
+            }
+        } else {
+            std::cerr << std::format("wc: {}: No such file or directory.\n", 
+                     file);
+        }
+    }
+
+    for (const auto& repository : repositories) {
+        const auto cache {repository.git_dir / "wc-cache"};
+
+        if (repository.cache.modified() and not repository.cache.save(cache)) {
+            read_err(std::cerr, cache.string());
+        }
+    }
+
+    int status {EXIT_SUCCESS};
+
+    if (total_sketch) {
+        total_stats.approx_distinct = total_sketch->estimate();
+
+        if (options->sketch_out and not total_sketch->save(options->sketch_out)) {
+            read_err(std::cerr, options->sketch_out);
+            status = EXIT_FAILURE;
+        }
+    }
+
+    if (nfiles > 1) {
+        if (total_stats.distinct) {
+            total_stats.distinct_lines = total_stats.distinct->count();
+
+            if (total_stats.distinct->error() != 0) {
+                errno = total_stats.distinct->error();
+                read_err(std::cerr, "total");
+            }
+        }
+
+        write_counts(std::cout, options.value(), total_stats, "total");
+
+        if (options->count_sloc) {
+            write_language_totals(std::cout, language_totals);
+        }
+    }
+
+    if (total_buckets) {
+        write_time_buckets(std::cout, *total_buckets);
+    }
+
+    if (total_frequencies) {
+        write_top_words(std::cout, options.value(), *total_frequencies);
     }
+    return status;
 }